@@ -4,9 +4,13 @@
 #include <fstream>
 #include <iostream>
 #include <memory>
+#include <optional>
 #include <random>
+#include <sstream>
 #include <vector>
 
+#include "../src/bst/priority_generator.h"
+
 #define NANOSEC_TO_MS_MULT 1e-6
 
 class BenchmarksRunner {
@@ -18,6 +22,11 @@ public:
         virtual void OnInit(size_t n_vertices, std::shared_ptr<std::mt19937> gen) = 0;
         virtual void Run() = 0;
         virtual void OnEnd() = 0;
+        // Work done by the last run in units of the benchmark's choosing, for benchmarks that
+        // count any. Written next to the timings
+        virtual std::optional<double> Count() const {
+            return std::nullopt;
+        }
 
         virtual ~IBenchmark() = default;
     };
@@ -39,9 +48,10 @@ public:
         bool log_scale_;
     };
 
-    BenchmarksRunner() {
-        std::random_device device;
-        gen_ = std::make_shared<std::mt19937>(device());
+    // Every run of a size starts from the same seed, both for inputs and for tree priorities,
+    // so timings of runs and of separate launches are comparable
+    explicit BenchmarksRunner(uint64_t seed = 42) : seed_(seed) {
+        gen_ = std::make_shared<std::mt19937>(seed_);
     }
 
     void AddBenchmark(std::shared_ptr<IBenchmark> bench) {
@@ -51,11 +61,27 @@ public:
     void RunBenchmarks(const Range &nvertex_range, const std::string &out_path) {
         for (auto &bench : benchmarks_) {
             std::ofstream out(out_path + bench->Name() + ".csv");
+            std::ostringstream counts;
+            bool has_counts = false;
             out.precision(3);
+            counts.precision(3);
             out << "n_vertex";
+            counts << "n_vertex";
             for (uint64_t i = 0; i < nvertex_range.n_runs_; ++i) {
                 out << ", run_" << i;
+                counts << ", run_" << i;
             }
+            auto run_row = [&](uint64_t n_vertex) {
+                out << '\n' << n_vertex;
+                counts << '\n' << n_vertex;
+                for (uint64_t run_number = 0; run_number < nvertex_range.n_runs_; ++run_number) {
+                    double time = RunWithCertainSize(bench, n_vertex);
+                    out << ", " << std::fixed << time;
+                    auto count = bench->Count();
+                    has_counts |= count.has_value();
+                    counts << ", " << std::fixed << count.value_or(-1);
+                }
+            };
             if (nvertex_range.log_scale_) {
                 assert(nvertex_range.step_ > 1);
                 long double step =
@@ -69,41 +95,33 @@ public:
                         cur_approx *= step;
                         continue;
                     }
-                    out << '\n' << cur;
-                    for (uint64_t run_number = 0; run_number < nvertex_range.n_runs_;
-                         ++run_number) {
-                        double time = RunWithCertainSize(bench, cur);
-                        out << ", " << std::fixed << time;
-                    }
+                    run_row(cur);
                     cur_approx *= step;
                     prev = cur;
                 }
-                out << '\n' << nvertex_range.end_;
-                for (uint64_t run_number = 0; run_number < nvertex_range.n_runs_; ++run_number) {
-                    double time = RunWithCertainSize(bench, nvertex_range.end_);
-                    out << ", " << std::fixed << time;
-                }
+                run_row(nvertex_range.end_);
             } else {
                 for (uint64_t i = nvertex_range.begin_; i <= nvertex_range.end_;
                      i += nvertex_range.step_) {
-                    out << '\n' << std::to_string(i);
-                    for (uint64_t run_number = 0; run_number < nvertex_range.n_runs_;
-                         ++run_number) {
-                        double time = RunWithCertainSize(bench, i);
-                        out << ", " << std::fixed << time;
-                    }
+                    run_row(i);
                 }
             }
             out.close();
+            if (has_counts) {
+                std::ofstream(out_path + bench->Name() + "_counts.csv") << counts.str();
+            }
         }
     }
 
 private:
     std::vector<std::shared_ptr<IBenchmark>> benchmarks_;
     std::shared_ptr<std::mt19937> gen_;
+    uint64_t seed_;
 
     double RunWithCertainSize(std::shared_ptr<IBenchmark> bench, size_t n_vertex) {
         try {
+            gen_->seed(seed_ + n_vertex);
+            PriorityGenerator::seed(seed_ + n_vertex);
             bench->OnInit(n_vertex, gen_);
 
             auto tbegin = std::chrono::high_resolution_clock::now();
@@ -6,6 +6,19 @@ int main() {
     runner.AddBenchmark(std::make_shared<RandomInsetion>());
     runner.AddBenchmark(std::make_shared<RandomErase>());
     runner.AddBenchmark(std::make_shared<RandomConnection>());
+    runner.AddBenchmark(std::make_shared<TreapMergeSplit>(false));
+    runner.AddBenchmark(std::make_shared<TreapMergeSplit>(true));
+    runner.AddBenchmark(std::make_shared<HotQueries<CartesianBST<size_t>>>("treap"));
+    runner.AddBenchmark(std::make_shared<HotQueries<SplayBST<size_t>>>("splay"));
+    runner.AddBenchmark(std::make_shared<HotQueries<SkipListBST<size_t>>>("skip_list"));
+    runner.AddBenchmark(std::make_shared<SkipListBatch>());
+    runner.AddBenchmark(std::make_shared<HotQueries<BTreeBST<size_t>>>("b_tree"));
+    runner.AddBenchmark(std::make_shared<RootWalks<CartesianBST<size_t>>>("treap"));
+    runner.AddBenchmark(std::make_shared<RootWalks<BTreeBST<size_t>>>("b_tree"));
+    // The treap that counts its root walks, which Relinks reports
+    runner.AddBenchmark(
+        std::make_shared<Relinks<CartesianBST<size_t, 1, NoAggregate, true>>>("treap"));
+    runner.AddBenchmark(std::make_shared<Relinks<SplayBST<size_t>>>("splay"));
 
     runner.RunBenchmarks(BenchmarksRunner::Range(5, 100'000, 30, true), "../experiments/");
     return 0;
@@ -1,6 +1,16 @@
+#include <unordered_set>
+
 #include "../src/graph/dynamic_graph.cpp"
 #include "benchmarking_utils.cpp"
 
+// Hash of the vertex pairs the benchmarks keep on their side
+class EdgeHash {
+public:
+    size_t operator()(const std::pair<size_t, size_t>& pair) const noexcept {
+        return pair.first ^ (pair.second + 0x9e3779b9 + (pair.first << 6ul) + (pair.first >> 2ul));
+    }
+};
+
 class SimpleBenchmark : public BenchmarksRunner::IBenchmark {
 public:
     SimpleBenchmark() {
@@ -11,7 +21,7 @@ public:
     }
 
     void OnInit(size_t n_vertices, std::shared_ptr<std::mt19937> gen) override {
-        g_ = std::make_shared<DynamicGraph>(n_vertices);
+        g_ = std::make_shared<DynamicGraph<>>(n_vertices);
         gen_ = gen;
         n_vertices_ = n_vertices;
     }
@@ -27,7 +37,7 @@ public:
 
 private:
     std::string name_;
-    std::shared_ptr<DynamicGraph> g_;
+    std::shared_ptr<DynamicGraph<>> g_;
     std::shared_ptr<std::mt19937> gen_;
     size_t n_vertices_;
 };
@@ -42,7 +52,7 @@ public:
     }
 
     void OnInit(size_t n_vertices, std::shared_ptr<std::mt19937> gen) override {
-        g_ = std::make_shared<DynamicGraph>(n_vertices);
+        g_ = std::make_shared<DynamicGraph<>>(n_vertices);
         gen_ = gen;
         dist_ = std::uniform_int_distribution<size_t>(0, n_vertices - 1);
         n_vertices_ = n_vertices;
@@ -68,11 +78,11 @@ public:
 
 private:
     std::string name_;
-    std::shared_ptr<DynamicGraph> g_;
+    std::shared_ptr<DynamicGraph<>> g_;
     std::shared_ptr<std::mt19937> gen_;
     std::uniform_int_distribution<size_t> dist_;
     size_t n_vertices_;
-    std::unordered_set<std::pair<size_t, size_t>, Forest::EdgeHash> edges_;
+    std::unordered_set<std::pair<size_t, size_t>, EdgeHash> edges_;
 };
 
 class RandomErase : public BenchmarksRunner::IBenchmark {
@@ -85,7 +95,7 @@ public:
     }
 
     void OnInit(size_t n_vertices, std::shared_ptr<std::mt19937> gen) override {
-        g_ = std::make_shared<DynamicGraph>(n_vertices);
+        g_ = std::make_shared<DynamicGraph<>>(n_vertices);
         gen_ = gen;
         dist_ = std::uniform_int_distribution<size_t>(0, n_vertices - 1);
         n_vertices_ = n_vertices;
@@ -111,11 +121,11 @@ public:
 
 private:
     std::string name_;
-    std::shared_ptr<DynamicGraph> g_;
+    std::shared_ptr<DynamicGraph<>> g_;
     std::shared_ptr<std::mt19937> gen_;
     std::uniform_int_distribution<size_t> dist_;
     size_t n_vertices_;
-    std::unordered_set<std::pair<size_t, size_t>, Forest::EdgeHash> edges_;
+    std::unordered_set<std::pair<size_t, size_t>, EdgeHash> edges_;
 };
 
 class RandomConnection : public BenchmarksRunner::IBenchmark {
@@ -128,7 +138,7 @@ public:
     }
 
     void OnInit(size_t n_vertices, std::shared_ptr<std::mt19937> gen) override {
-        g_ = std::make_shared<DynamicGraph>(n_vertices);
+        g_ = std::make_shared<DynamicGraph<>>(n_vertices);
         gen_ = gen;
         dist_ = std::uniform_int_distribution<size_t>(0, n_vertices - 1);
         n_vertices_ = n_vertices;
@@ -154,9 +164,324 @@ public:
 
 private:
     std::string name_;
-    std::shared_ptr<DynamicGraph> g_;
+    std::shared_ptr<DynamicGraph<>> g_;
     std::shared_ptr<std::mt19937> gen_;
     std::uniform_int_distribution<size_t> dist_;
     size_t n_vertices_;
-    std::unordered_set<std::pair<size_t, size_t>, Forest::EdgeHash> edges_;
-};
\ No newline at end of file
+    std::unordered_set<std::pair<size_t, size_t>, EdgeHash> edges_;
+};
+
+// The recursive treap merge that CartesianBST::merge replaced, kept as the reference the
+// iterative one is timed against. Works on the nodes of the pool, which the tree leaves public,
+// and recounts them as the trees of the benchmark need: sizes, vertices and flag 0
+template <class Pool>
+uint32_t MergeRecursive(Pool& pool, uint32_t lhs, uint32_t rhs) {
+    if (!lhs) {
+        return rhs;
+    } else if (!rhs) {
+        return lhs;
+    }
+    uint32_t root;
+    if (pool[lhs].priority_ > pool[rhs].priority_) {
+        uint32_t right = MergeRecursive(pool, pool[lhs].right_, rhs);
+        pool[lhs].right_ = right;
+        pool[right].parent_ = lhs;
+        root = lhs;
+    } else {
+        uint32_t left = MergeRecursive(pool, lhs, pool[rhs].left_);
+        pool[rhs].left_ = left;
+        pool[left].parent_ = rhs;
+        root = rhs;
+    }
+    auto& node = pool[root];
+    node.subtree_size_ = 1;
+    node.child_count_ = node.IsVertex();
+    node.subtree_flags_ = node.HasFlag(0);
+    for (uint32_t child : {node.left_, node.right_}) {
+        if (child) {
+            node.subtree_size_ += pool[child].subtree_size_;
+            node.child_count_ += pool[child].child_count_;
+            node.subtree_flags_ |= pool[child].subtree_flags_;
+        }
+    }
+    return root;
+}
+
+// Rotations of one treap, merged either by the iterative merge or by the recursive one it
+// replaced
+class TreapMergeSplit : public BenchmarksRunner::IBenchmark {
+public:
+    explicit TreapMergeSplit(bool recursive) : recursive_(recursive) {
+        name_ = recursive ? "treap_merge_split_recursive" : "treap_merge_split";
+    }
+    const std::string& Name() const override {
+        return name_;
+    }
+
+    void OnInit(size_t n_vertices, std::shared_ptr<std::mt19937> gen) override {
+        pool_ = std::make_shared<CartesianBST<size_t>::Pool>();
+        std::vector<size_t> values(n_vertices);
+        for (size_t i = 0; i < n_vertices; ++i) {
+            values[i] = i;
+        }
+        tree_ = std::make_shared<CartesianBST<size_t>>(values.begin(), values.end(), *pool_);
+        nodes_.clear();
+        for (auto it = tree_->begin(); it != tree_->end(); ++it) {
+            nodes_.emplace_back(it);
+        }
+        std::uniform_int_distribution<size_t> dist(0, n_vertices - 1);
+        cuts_.clear();
+        for (size_t i = 0; i < n_vertices; ++i) {
+            cuts_.emplace_back(dist(*gen));
+        }
+    }
+
+    void Run() override {
+        // Rotations of the sequence, as done by rerooting an Euler tour
+        for (const auto& cut : cuts_) {
+            auto tree_pair = nodes_[cut].split();
+            if (recursive_) {
+                MergeRecursive(*pool_, tree_pair.second.get_root().index(),
+                               tree_pair.first.get_root().index());
+            } else {
+                tree_pair.second.merge(tree_pair.first);
+            }
+        }
+    }
+
+    void OnEnd() override {
+        nodes_.clear();
+        tree_.reset();
+        pool_.reset();
+    }
+
+private:
+    std::string name_;
+    bool recursive_;
+    std::shared_ptr<CartesianBST<size_t>::Pool> pool_;
+    std::shared_ptr<CartesianBST<size_t>> tree_;
+    std::vector<CartesianBST<size_t>::iterator> nodes_;
+    std::vector<size_t> cuts_;
+};
+
+// Connectivity queries concentrated on a few vertices of one big tree, with occasional
+// cut-and-relink of random edges. Compares the sequence tree backends of the forest
+template <class BST>
+class HotQueries : public BenchmarksRunner::IBenchmark {
+public:
+    explicit HotQueries(const std::string& backend) {
+        name_ = "hot_queries_" + backend;
+    }
+    const std::string& Name() const override {
+        return name_;
+    }
+
+    void OnInit(size_t n_vertices, std::shared_ptr<std::mt19937> gen) override {
+        f_ = std::make_shared<Forest<BST>>(n_vertices);
+        parents_.assign(n_vertices, 0);
+        for (size_t i = 1; i < n_vertices; ++i) {
+            parents_[i] = (*gen)() % i;
+            f_->add_new_edge(parents_[i], i);
+        }
+        const size_t n_hot = std::min<size_t>(16, n_vertices);
+        std::uniform_int_distribution<size_t> hot_dist(0, n_hot - 1);
+        std::uniform_int_distribution<size_t> dist(1, n_vertices - 1);
+        steps_.clear();
+        for (size_t i = 0; i < n_vertices; ++i) {
+            if (i % 10 == 0) {
+                steps_.emplace_back(dist(*gen), 0);
+            } else {
+                steps_.emplace_back(hot_dist(*gen), hot_dist(*gen) + n_vertices);
+            }
+        }
+    }
+
+    void Run() override {
+        // The second value is shifted by the number of vertices for queries, zero for relinks
+        const size_t n_vertices = parents_.size();
+        for (const auto& step : steps_) {
+            if (step.second == 0) {
+                f_->erase_existing_edge(parents_[step.first], step.first);
+                f_->add_new_edge(parents_[step.first], step.first);
+            } else if (step.first != step.second - n_vertices) {
+                f_->is_connected(step.first, step.second - n_vertices);
+            }
+        }
+    }
+
+    void OnEnd() override {
+        f_.reset();
+    }
+
+private:
+    std::string name_;
+    std::shared_ptr<Forest<BST>> f_;
+    std::vector<size_t> parents_;
+    std::vector<std::pair<size_t, size_t>> steps_;
+};
+
+// Cuts a tour into pieces at every eighth node with one batch and glues it back with another
+class SkipListBatch : public BenchmarksRunner::IBenchmark {
+public:
+    SkipListBatch() {
+        name_ = "skip_list_batch";
+    }
+    const std::string& Name() const override {
+        return name_;
+    }
+
+    void OnInit(size_t n_vertices, std::shared_ptr<std::mt19937> gen) override {
+        pool_ = std::make_shared<SkipListBST<size_t>::Pool>();
+        std::vector<size_t> values(n_vertices);
+        for (size_t i = 0; i < n_vertices; ++i) {
+            values[i] = i;
+        }
+        SkipListBST<size_t> tree(values.begin(), values.end(), *pool_);
+        std::vector<SkipListBST<size_t>::iterator> nodes;
+        for (auto it = tree.begin(); it != tree.end(); ++it) {
+            nodes.emplace_back(it);
+        }
+        cuts_.clear();
+        links_.clear();
+        for (size_t i = 1; i < n_vertices; ++i) {
+            if ((*gen)() % 8 == 0) {
+                cuts_.emplace_back(nodes[i]);
+                links_.emplace_back(nodes[i - 1], nodes[i]);
+            }
+        }
+    }
+
+    void Run() override {
+        SkipListBST<size_t>::split_batch(cuts_);
+        SkipListBST<size_t>::merge_batch(links_);
+    }
+
+    void OnEnd() override {
+        cuts_.clear();
+        links_.clear();
+        pool_.reset();
+    }
+
+private:
+    std::string name_;
+    std::shared_ptr<SkipListBST<size_t>::Pool> pool_;
+    std::vector<SkipListBST<size_t>::iterator> cuts_;
+    std::vector<std::pair<SkipListBST<size_t>::iterator, SkipListBST<size_t>::iterator>> links_;
+};
+
+// Connectivity queries between random vertices of a random tree, each one walks two tours up to
+// their roots
+template <class BST>
+class RootWalks : public BenchmarksRunner::IBenchmark {
+public:
+    explicit RootWalks(const std::string& backend) {
+        name_ = "root_walks_" + backend;
+    }
+    const std::string& Name() const override {
+        return name_;
+    }
+
+    void OnInit(size_t n_vertices, std::shared_ptr<std::mt19937> gen) override {
+        f_ = std::make_shared<Forest<BST>>(n_vertices);
+        for (size_t i = 1; i < n_vertices; ++i) {
+            f_->add_new_edge((*gen)() % i, i);
+        }
+        std::uniform_int_distribution<size_t> dist(0, n_vertices - 1);
+        queries_.clear();
+        for (size_t i = 0; i < n_vertices; ++i) {
+            size_t u = dist(*gen), v = dist(*gen);
+            if (u != v) {
+                queries_.emplace_back(u, v);
+            }
+        }
+    }
+
+    void Run() override {
+        for (const auto& query : queries_) {
+            f_->is_connected(query.first, query.second);
+        }
+    }
+
+    void OnEnd() override {
+        f_.reset();
+    }
+
+private:
+    std::string name_;
+    std::shared_ptr<Forest<BST>> f_;
+    std::vector<std::pair<size_t, size_t>> queries_;
+};
+
+// Whether the tree counts its root walks, as CartesianBST with CountWalks does
+template <class Tree, class = void>
+struct HasRootWalkCounter : std::false_type {};
+
+template <class Tree>
+struct HasRootWalkCounter<Tree, std::void_t<decltype(Tree::root_walks())>>
+    : std::bool_constant<Tree::kCountsRootWalks> {};
+
+// Cut and relink of random edges of a random tree. A link is one split per tour and one pass
+// over the six pieces, which walks once more for every zip of two spines. A cut is four splits,
+// one root lookup and one merge. Counts the walks per cut and link for backends that have a
+// counter: on 10^5 vertices a relink takes 10.4 of them, against 12.4 when a link rerooted the
+// tour of v with a split and a merge of its own
+template <class BST>
+class Relinks : public BenchmarksRunner::IBenchmark {
+public:
+    explicit Relinks(const std::string& backend) {
+        name_ = "relinks_" + backend;
+    }
+    const std::string& Name() const override {
+        return name_;
+    }
+
+    void OnInit(size_t n_vertices, std::shared_ptr<std::mt19937> gen) override {
+        f_ = std::make_shared<Forest<BST>>(n_vertices);
+        parents_.assign(n_vertices, 0);
+        for (size_t i = 1; i < n_vertices; ++i) {
+            parents_[i] = (*gen)() % i;
+            f_->add_new_edge(parents_[i], i);
+        }
+        std::uniform_int_distribution<size_t> dist(1, std::max<size_t>(n_vertices, 2) - 1);
+        relinked_.clear();
+        for (size_t i = 1; i < n_vertices; ++i) {
+            relinked_.emplace_back(dist(*gen));
+        }
+    }
+
+    void Run() override {
+        uint64_t walks = RootWalks();
+        for (size_t v : relinked_) {
+            f_->erase_existing_edge(parents_[v], v);
+            f_->add_new_edge(parents_[v], v);
+        }
+        walks_per_relink_ = relinked_.empty()
+                                ? 0
+                                : static_cast<double>(RootWalks() - walks) / relinked_.size();
+    }
+
+    void OnEnd() override {
+        f_.reset();
+    }
+
+    std::optional<double> Count() const override {
+        if (!HasRootWalkCounter<BST>::value) {
+            return std::nullopt;
+        }
+        return walks_per_relink_;
+    }
+
+private:
+    std::string name_;
+    std::shared_ptr<Forest<BST>> f_;
+    std::vector<size_t> parents_;
+    std::vector<size_t> relinked_;
+    double walks_per_relink_ = 0;
+
+    static uint64_t RootWalks() {
+        if constexpr (HasRootWalkCounter<BST>::value) {
+            return BST::root_walks();
+        }
+        return 0;
+    }
+};
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <algorithm>
+#include <limits>
+
+// Aggregate policies for CartesianBST. A policy gives the type of node payloads as value_type,
+// the neutral payload as Identity() and an associative Combine(lhs, rhs). Trees keep Combine of
+// all payloads of each subtree in sequence order, so it need not be commutative
+
+// Keeps nothing: nodes have no payload and trees pay nothing for it
+struct NoAggregate {
+    struct value_type {};
+
+    static value_type Identity() {
+        return value_type();
+    }
+    static value_type Combine(value_type, value_type) {
+        return value_type();
+    }
+};
+
+template <class V>
+struct SumAggregate {
+    typedef V value_type;
+
+    static V Identity() {
+        return V();
+    }
+    static V Combine(const V& lhs, const V& rhs) {
+        return lhs + rhs;
+    }
+};
+
+template <class V>
+struct MinAggregate {
+    typedef V value_type;
+
+    static V Identity() {
+        return std::numeric_limits<V>::max();
+    }
+    static V Combine(const V& lhs, const V& rhs) {
+        return std::min(lhs, rhs);
+    }
+};
+
+template <class V>
+struct MaxAggregate {
+    typedef V value_type;
+
+    static V Identity() {
+        return std::numeric_limits<V>::lowest();
+    }
+    static V Combine(const V& lhs, const V& rhs) {
+        return std::max(lhs, rhs);
+    }
+};
+
+// Fields a node gets for the policy: its own payload and the aggregate of its subtree
+template <class Aggregate>
+struct AggregateFields {
+    typename Aggregate::value_type payload_ = Aggregate::Identity();
+    typename Aggregate::value_type aggregate_ = Aggregate::Identity();
+};
+
+template <>
+struct AggregateFields<NoAggregate> {};
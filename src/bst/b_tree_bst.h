@@ -0,0 +1,733 @@
+#pragma once
+
+#include <algorithm>
+#include <initializer_list>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "node_pool.h"
+#include "sequence_ops.h"
+
+// B-tree over a sequence with the same interface as CartesianBST. Elements are leaves that never
+// move, so iterators stay valid; inner nodes keep per child the counts of vertices and of leaves
+// with each flag, and take two cache lines with one flag. Leaves carry Flags flags like in
+// CartesianBST. All leaves are at the same depth, which is about log_6 of the size, so root walks
+// touch several times fewer nodes than in a treap
+template <class T, size_t Flags = 1>
+class BTreeBST {
+    static_assert(Flags >= 1 && Flags <= 8, "Flags of a leaf are kept in one byte");
+
+private:
+    // Measured with random splits and merges after churn, against a treap of the same size:
+    // fanout 8 cuts the depth of a leaf 3.0x at 1e5 and 3.2x at 1e6 leaves, fanout 16 4.2x and
+    // 4.3x. Fanout 16 walks to the root about 35% faster, but a split with a merge costs 10-20%
+    // more and inner nodes grow to four cache lines; fanout 32 doubles the split and merge cost.
+    // A link in a forest is seven splits and merges against two walks for a query, so updates
+    // decide and fanout 8 stays
+    static constexpr uint32_t kMaxChildren = 8;
+    static constexpr uint32_t kMinChildren = kMaxChildren / 2;
+
+    struct Leaf {
+        Leaf() = default;
+        explicit Leaf(const T& value) : value_(value) {
+        }
+
+        uint32_t parent_ = 0;
+        bool is_vertex_ = false;
+        uint8_t flags_ = 0;
+        T value_ = T();
+
+        bool HasFlag(size_t flag) const {
+            return (flags_ >> flag) & 1;
+        }
+    };
+
+    // One spare slot holds a child while the node is being split
+    struct alignas(64) Inner {
+        uint32_t parent_ = 0;
+        uint8_t size_ = 0;
+        // Leaves are children of nodes of height 1
+        uint8_t height_ = 1;
+        uint32_t children_[kMaxChildren + 1] = {};
+        uint32_t counts_[kMaxChildren + 1] = {};
+        uint32_t flagged_counts_[Flags][kMaxChildren + 1] = {};
+    };
+    static_assert(Flags > 1 || sizeof(Inner) == 128, "Inner nodes take two cache lines");
+
+public:
+    typedef T value_type;
+
+    static constexpr size_t kFlags = Flags;
+
+    class Pool {
+    public:
+        static constexpr uint32_t kNull = 0;
+
+        Pool() = default;
+
+        // Number of leaves currently handed out
+        size_t Used() const {
+            return leaves_.Used();
+        }
+
+        void BeginWrite() {
+            leaves_.BeginWrite();
+            inners_.BeginWrite();
+        }
+        void EndWrite() {
+            inners_.EndWrite();
+            leaves_.EndWrite();
+        }
+
+        static Pool& Default() {
+            static Pool pool;
+            return pool;
+        }
+
+    private:
+        NodePool<Leaf> leaves_;
+        NodePool<Inner> inners_;
+
+        friend class BTreeBST;
+    };
+
+private:
+    static constexpr uint32_t kNull = Pool::kNull;
+
+public:
+    class iterator {
+    public:
+        iterator() : pool_(nullptr), it_(kNull), is_end_(true) {
+        }
+        iterator(Pool* pool, uint32_t pointer, bool is_end = false)
+            : pool_(pool), it_(pointer), is_end_(is_end) {
+        }
+
+        iterator& operator++() {
+            if (is_end_) {
+                throw std::runtime_error("Index out of range while increasing");
+            }
+            Pool& pool = *pool_;
+            uint32_t child = it_, node = pool.leaves_[it_].parent_;
+            while (node) {
+                const Inner& inner = pool.inners_[node];
+                uint32_t pos = IndexOf(inner, child) + 1;
+                if (pos < inner.size_) {
+                    it_ = Leftmost(pool, node, pos);
+                    return *this;
+                }
+                child = node;
+                node = inner.parent_;
+            }
+            is_end_ = true;
+            return *this;
+        }
+        iterator operator++(int) {
+            iterator cpy(*this);
+            ++*this;
+            return cpy;
+        }
+        // Moves to the next leaf with the flag, skipping subtrees without it
+        iterator& next_flagged(size_t flag) {
+            if (is_end_) {
+                throw std::runtime_error("Index out of range while increasing");
+            }
+            Pool& pool = *pool_;
+            uint32_t child = it_, node = pool.leaves_[it_].parent_;
+            while (node) {
+                const Inner& inner = pool.inners_[node];
+                uint32_t pos = FirstFlagged(inner, IndexOf(inner, child) + 1, flag);
+                if (pos < inner.size_) {
+                    it_ = LeftmostFlagged(pool, node, pos, flag);
+                    return *this;
+                }
+                child = node;
+                node = inner.parent_;
+            }
+            it_ = Rightmost(pool, child, pool.inners_[child].size_ - 1);
+            is_end_ = true;
+            return *this;
+        }
+        iterator& next_with_level_edges() {
+            return next_flagged(0);
+        }
+        iterator& operator--() {
+            if (is_end_) {
+                if (!it_) {
+                    throw std::runtime_error("Index out of range while decreasing");
+                }
+                is_end_ = false;
+                return *this;
+            }
+            Pool& pool = *pool_;
+            uint32_t child = it_, node = pool.leaves_[it_].parent_;
+            while (node) {
+                const Inner& inner = pool.inners_[node];
+                uint32_t pos = IndexOf(inner, child);
+                if (pos > 0) {
+                    it_ = Rightmost(pool, node, pos - 1);
+                    return *this;
+                }
+                child = node;
+                node = inner.parent_;
+            }
+            throw std::runtime_error("Index out of range while decreasing");
+        }
+        iterator operator--(int) {
+            iterator cpy(*this);
+            --*this;
+            return cpy;
+        }
+
+        const T operator*() const {
+            if (is_end_) {
+                throw std::runtime_error("Index out of range in operator*");
+            }
+            return pool_->leaves_[it_].value_;
+        }
+        const T* operator->() const {
+            if (is_end_) {
+                throw std::runtime_error("Index out of range in operator->");
+            }
+            return &pool_->leaves_[it_].value_;
+        }
+
+        bool operator==(const iterator& other) const {
+            return it_ == other.it_ && is_end_ == other.is_end_ && pool_ == other.pool_;
+        }
+        bool operator!=(const iterator& other) const {
+            return !(*this == other);
+        }
+
+        // Trees are identified by their first leaf
+        iterator get_root() const {
+            if (!it_) {
+                return *this;
+            }
+            return iterator(pool_, Leftmost(*pool_, FindRoot(*pool_, it_), 0));
+        }
+
+        std::pair<BTreeBST, BTreeBST> split() const {
+            if (is_end_) {
+                throw std::logic_error("Cannot split in empty parts");
+            }
+            auto roots = Split(*pool_, it_);
+            return std::make_pair(BTreeBST(pool_, roots.first), BTreeBST(pool_, roots.second));
+        }
+
+        void set_flag(size_t flag, bool value) const {
+            Leaf& leaf = pool_->leaves_[it_];
+            if (leaf.HasFlag(flag) != value) {
+                leaf.flags_ ^= 1u << flag;
+                AddToAncestors(*pool_, it_, 0, flag, value ? 1 : -1);
+            }
+        }
+
+        bool has_flag(size_t flag) const {
+            return pool_->leaves_[it_].HasFlag(flag);
+        }
+
+        void set_has_level_edges(bool has_level_edges) const {
+            set_flag(0, has_level_edges);
+        }
+
+        bool has_level_edges() const {
+            return has_flag(0);
+        }
+
+        void set_is_vertex(bool is_vertex) const {
+            Leaf& leaf = pool_->leaves_[it_];
+            if (leaf.is_vertex_ != is_vertex) {
+                leaf.is_vertex_ = is_vertex;
+                AddToAncestors(*pool_, it_, is_vertex ? 1 : -1);
+            }
+        }
+
+        Pool* pool() const {
+            return pool_;
+        }
+        uint32_t index() const {
+            return it_;
+        }
+        bool is_end() const {
+            return is_end_;
+        }
+
+    private:
+        Pool* pool_;
+        uint32_t it_;
+        bool is_end_;
+    };
+
+    BTreeBST() = delete;
+
+    // Takes the root inner node of a tree, kNull for an empty one
+    BTreeBST(Pool* pool, uint32_t root) : pool_(pool), root_(root) {
+    }
+
+    template <class InitIterator>
+    BTreeBST(InitIterator begin, InitIterator end, Pool& pool = Pool::Default())
+        : BTreeBST(begin, end, NoFlags(), pool) {
+    }
+
+    // Marks the nodes for which the flags sequence is true as vertices. Linear time
+    template <class InitIterator, class FlagIterator>
+    BTreeBST(InitIterator begin, InitIterator end, FlagIterator is_vertex, Pool& pool)
+        : BTreeBST(begin, end, is_vertex, pool, [](uint32_t) {}) {
+    }
+    // Also passes the leaf of every value to on_node, in order
+    template <class InitIterator, class FlagIterator, class NodeVisitor>
+    BTreeBST(InitIterator begin, InitIterator end, FlagIterator is_vertex, Pool& pool,
+             NodeVisitor on_node)
+        : pool_(&pool), root_(kNull) {
+        std::vector<uint32_t> level;
+        for (InitIterator cur(begin); cur != end; ++cur, ++is_vertex) {
+            level.emplace_back(pool.leaves_.Allocate(*cur));
+            pool.leaves_[level.back()].is_vertex_ = *is_vertex;
+            on_node(level.back());
+        }
+        if (level.empty()) {
+            return;
+        }
+        // Even groups keep every node at least half full
+        for (uint8_t height = 1;; ++height) {
+            size_t n_groups = (level.size() + kMaxChildren - 1) / kMaxChildren;
+            std::vector<uint32_t> next_level;
+            for (size_t group = 0, begin = 0; group < n_groups; ++group) {
+                size_t end = begin + level.size() / n_groups + (group < level.size() % n_groups);
+                uint32_t node = NewInner(pool, height);
+                for (size_t i = begin; i < end; ++i) {
+                    Insert(pool, node, pool.inners_[node].size_, level[i]);
+                }
+                next_level.emplace_back(node);
+                begin = end;
+            }
+            level.swap(next_level);
+            if (level.size() == 1) {
+                break;
+            }
+        }
+        root_ = level.front();
+    }
+
+    BTreeBST(const BTreeBST& other) = default;
+    BTreeBST& operator=(const BTreeBST& other) = default;
+
+    ~BTreeBST() = default;
+
+    iterator begin(bool with_level_edges = false) const {
+        if (empty()) {
+            return end();
+        }
+        if (with_level_edges) {
+            return begin_flagged(0);
+        }
+        return iterator(pool_, Leftmost(*pool_, root_, 0));
+    }
+    // The first leaf with the flag, or end()
+    iterator begin_flagged(size_t flag) const {
+        if (empty()) {
+            return end();
+        }
+        uint32_t pos = FirstFlagged(pool_->inners_[root_], 0, flag);
+        if (pos == pool_->inners_[root_].size_) {
+            return end();
+        }
+        return iterator(pool_, LeftmostFlagged(*pool_, root_, pos, flag));
+    }
+    iterator end() const {
+        if (empty()) {
+            return iterator(pool_, kNull, true);
+        }
+        return iterator(pool_, Rightmost(*pool_, root_, pool_->inners_[root_].size_ - 1), true);
+    }
+
+    // What get_root() of any of its nodes returns, without walking up to it
+    iterator get_root() const {
+        return iterator(pool_, empty() ? kNull : Leftmost(*pool_, root_, 0));
+    }
+
+    // Appends the other tree. The other handle must not be used afterwards
+    void merge(BTreeBST other) {
+        if (!empty() && !other.empty() && pool_ != other.pool_) {
+            throw std::logic_error("Cannot merge trees from different pools");
+        }
+        if (empty()) {
+            pool_ = other.pool_;
+        }
+        root_ = Join(*pool_, root_, other.root_);
+    }
+
+    // Appends all the trees, see MergeEach
+    void merge_all(const std::vector<BTreeBST>& others) {
+        MergeEach(this, others.begin(), others.end());
+    }
+    // The same for a braced list of trees, which needs no vector
+    void merge_all(std::initializer_list<BTreeBST> others) {
+        MergeEach(this, others.begin(), others.end());
+    }
+
+    // Cuts the tree holding the points before each of them, see SplitEach. Each cut is
+    // O(log n)
+    static void split_at(const std::vector<iterator>& points, std::vector<BTreeBST>* parts) {
+        SplitEach(points, parts, [](const iterator& point) {
+            uint32_t leaf = point.index();
+            return BTreeBST(point.pool(), leaf ? FindRoot(*point.pool(), leaf) : kNull);
+        });
+    }
+
+    // Calls the visitor with the value of every leaf with the flag, in order. The walks skip the
+    // subtrees without the flag, see CartesianBST::for_each_flagged. The visitor must not change
+    // the tree
+    template <class Visitor>
+    void for_each_flagged(size_t flag, Visitor visitor) const {
+        for (iterator it = begin_flagged(flag); !it.is_end(); it.next_flagged(flag)) {
+            visitor(pool_->leaves_[it.index()].value_);
+        }
+    }
+
+    // Appends the values of the leaves with the flag to out
+    void collect_flagged(size_t flag, std::vector<T>* out) const {
+        for_each_flagged(flag, [out](const T& value) { out->push_back(value); });
+    }
+
+    // Releases every node of the tree. Iterators into it become invalid
+    void clear() {
+        if (empty()) {
+            return;
+        }
+        Pool& pool = *pool_;
+        std::vector<uint32_t> stack = {root_};
+        while (!stack.empty()) {
+            uint32_t node = stack.back();
+            stack.pop_back();
+            const Inner& inner = pool.inners_[node];
+            for (uint32_t pos = 0; pos < inner.size_; ++pos) {
+                if (inner.height_ == 1) {
+                    pool.leaves_.Free(inner.children_[pos]);
+                } else {
+                    stack.emplace_back(inner.children_[pos]);
+                }
+            }
+            pool.inners_.Free(node);
+        }
+        root_ = kNull;
+    }
+
+    bool empty() const {
+        return !root_;
+    }
+
+    size_t size() const {
+        if (empty()) {
+            return 0;
+        }
+        const Inner& root = pool_->inners_[root_];
+        return Total(root, root.counts_);
+    }
+
+private:
+    Pool* pool_;
+    uint32_t root_;
+
+    /* ---------------------------------------------------
+     * ------------------STATIC METHODS-------------------
+     * ---------------------------------------------------
+     */
+
+    struct NoFlags {
+        bool operator*() const {
+            return false;
+        }
+        NoFlags& operator++() {
+            return *this;
+        }
+    };
+
+    static uint32_t NewInner(Pool& pool, uint8_t height) {
+        uint32_t node = pool.inners_.Allocate();
+        pool.inners_[node].height_ = height;
+        return node;
+    }
+
+    static uint32_t IndexOf(const Inner& inner, uint32_t child) {
+        uint32_t pos = 0;
+        while (inner.children_[pos] != child) {
+            ++pos;
+        }
+        return pos;
+    }
+
+    // Sum of the counts of the children of the node
+    static uint32_t Total(const Inner& inner, const uint32_t* counts) {
+        uint32_t total = 0;
+        for (uint32_t pos = 0; pos < inner.size_; ++pos) {
+            total += counts[pos];
+        }
+        return total;
+    }
+
+    // The first child from pos on with the flag in its subtree, size_ if there is none
+    static uint32_t FirstFlagged(const Inner& inner, uint32_t pos, size_t flag) {
+        while (pos < inner.size_ && !inner.flagged_counts_[flag][pos]) {
+            ++pos;
+        }
+        return pos;
+    }
+
+    // Puts the child at from_pos of one node with its counts into the slot at to_pos of another
+    static void CopyChild(const Inner& from, uint32_t from_pos, Inner& to, uint32_t to_pos) {
+        to.children_[to_pos] = from.children_[from_pos];
+        to.counts_[to_pos] = from.counts_[from_pos];
+        for (size_t flag = 0; flag < Flags; ++flag) {
+            to.flagged_counts_[flag][to_pos] = from.flagged_counts_[flag][from_pos];
+        }
+    }
+
+    static uint32_t FindRoot(const Pool& pool, uint32_t leaf) {
+        uint32_t node = pool.leaves_[leaf].parent_;
+        while (pool.inners_[node].parent_) {
+            node = pool.inners_[node].parent_;
+        }
+        return node;
+    }
+
+    // Both descend from the child at pos to a leaf
+    static uint32_t Leftmost(const Pool& pool, uint32_t node, uint32_t pos) {
+        uint32_t child = pool.inners_[node].children_[pos];
+        for (uint8_t height = pool.inners_[node].height_; height > 1; --height) {
+            child = pool.inners_[child].children_[0];
+        }
+        return child;
+    }
+    static uint32_t Rightmost(const Pool& pool, uint32_t node, uint32_t pos) {
+        uint32_t child = pool.inners_[node].children_[pos];
+        for (uint8_t height = pool.inners_[node].height_; height > 1; --height) {
+            const Inner& inner = pool.inners_[child];
+            child = inner.children_[inner.size_ - 1];
+        }
+        return child;
+    }
+    static uint32_t LeftmostFlagged(const Pool& pool, uint32_t node, uint32_t pos, size_t flag) {
+        uint32_t child = pool.inners_[node].children_[pos];
+        for (uint8_t height = pool.inners_[node].height_; height > 1; --height) {
+            const Inner& inner = pool.inners_[child];
+            child = inner.children_[FirstFlagged(inner, 0, flag)];
+        }
+        return child;
+    }
+
+    static void AddToAncestors(Pool& pool, uint32_t leaf, int count, size_t flag = 0,
+                               int flagged_count = 0) {
+        uint32_t child = leaf, node = pool.leaves_[leaf].parent_;
+        while (node) {
+            Inner& inner = pool.inners_[node];
+            uint32_t pos = IndexOf(inner, child);
+            inner.counts_[pos] += count;
+            inner.flagged_counts_[flag][pos] += flagged_count;
+            child = node;
+            node = inner.parent_;
+        }
+    }
+
+    // Takes the counts of the child at pos and makes the node its parent
+    static void Adopt(Pool& pool, uint32_t node, uint32_t pos) {
+        Inner& inner = pool.inners_[node];
+        uint32_t child = inner.children_[pos];
+        if (inner.height_ == 1) {
+            Leaf& leaf = pool.leaves_[child];
+            leaf.parent_ = node;
+            inner.counts_[pos] = leaf.is_vertex_;
+            for (size_t flag = 0; flag < Flags; ++flag) {
+                inner.flagged_counts_[flag][pos] = leaf.HasFlag(flag);
+            }
+        } else {
+            Inner& child_inner = pool.inners_[child];
+            child_inner.parent_ = node;
+            inner.counts_[pos] = Total(child_inner, child_inner.counts_);
+            for (size_t flag = 0; flag < Flags; ++flag) {
+                inner.flagged_counts_[flag][pos] =
+                    Total(child_inner, child_inner.flagged_counts_[flag]);
+            }
+        }
+    }
+
+    static void Insert(Pool& pool, uint32_t node, uint32_t pos, uint32_t child) {
+        Inner& inner = pool.inners_[node];
+        for (uint32_t i = inner.size_; i > pos; --i) {
+            CopyChild(inner, i - 1, inner, i);
+        }
+        inner.children_[pos] = child;
+        ++inner.size_;
+        Adopt(pool, node, pos);
+    }
+
+    // Moves the children from pos on to the end of another node of the same height
+    static void MoveTail(Pool& pool, uint32_t from, uint32_t pos, uint32_t to) {
+        Inner& source = pool.inners_[from];
+        Inner& target = pool.inners_[to];
+        for (uint32_t i = pos; i < source.size_; ++i) {
+            CopyChild(source, i, target, target.size_);
+            Adopt(pool, to, target.size_++);
+        }
+        source.size_ = pos;
+    }
+
+    // Drops the first children of the node
+    static void DropHead(Inner& inner, uint32_t n_dropped) {
+        for (uint32_t i = n_dropped; i < inner.size_; ++i) {
+            CopyChild(inner, i, inner, i - n_dropped);
+        }
+        inner.size_ -= n_dropped;
+    }
+
+    // Makes the children of two neighbours at least half full. Both together must not fit
+    // into one node
+    static void Rebalance(Pool& pool, uint32_t lhs, uint32_t rhs) {
+        Inner& left = pool.inners_[lhs];
+        Inner& right = pool.inners_[rhs];
+        uint32_t target = (left.size_ + right.size_) / 2;
+        if (left.size_ > target) {
+            uint32_t n_moved = left.size_ - target;
+            for (uint32_t i = right.size_; i-- > 0;) {
+                CopyChild(right, i, right, i + n_moved);
+            }
+            for (uint32_t i = 0; i < n_moved; ++i) {
+                CopyChild(left, target + i, right, i);
+                Adopt(pool, rhs, i);
+            }
+            left.size_ = target;
+            right.size_ += n_moved;
+        } else if (left.size_ < target) {
+            uint32_t n_moved = target - left.size_;
+            for (uint32_t i = 0; i < n_moved; ++i) {
+                left.children_[left.size_] = right.children_[i];
+                Adopt(pool, lhs, left.size_++);
+            }
+            DropHead(right, n_moved);
+        }
+    }
+
+    // Restores the fill of the neighbour children at pos and pos + 1 if one of them is short
+    static void FixShort(Pool& pool, uint32_t node, uint32_t pos) {
+        Inner& inner = pool.inners_[node];
+        uint32_t lhs = inner.children_[pos], rhs = inner.children_[pos + 1];
+        uint32_t lhs_size = pool.inners_[lhs].size_, rhs_size = pool.inners_[rhs].size_;
+        if (lhs_size >= kMinChildren && rhs_size >= kMinChildren) {
+            return;
+        }
+        if (lhs_size + rhs_size <= kMaxChildren) {
+            MoveTail(pool, rhs, 0, lhs);
+            pool.inners_.Free(rhs);
+            for (uint32_t i = pos + 1; i + 1 < inner.size_; ++i) {
+                CopyChild(inner, i + 1, inner, i);
+            }
+            --inner.size_;
+        } else {
+            Rebalance(pool, lhs, rhs);
+            Adopt(pool, node, pos + 1);
+        }
+        Adopt(pool, node, pos);
+    }
+
+    // Splits overfull nodes and refreshes the counts from the node up to the root
+    static uint32_t Rise(Pool& pool, uint32_t node) {
+        while (true) {
+            uint32_t parent = pool.inners_[node].parent_;
+            if (pool.inners_[node].size_ > kMaxChildren) {
+                uint32_t sibling = NewInner(pool, pool.inners_[node].height_);
+                MoveTail(pool, node, (kMaxChildren + 2) / 2, sibling);
+                if (!parent) {
+                    parent = NewInner(pool, pool.inners_[node].height_ + 1);
+                    Insert(pool, parent, 0, node);
+                    Insert(pool, parent, 1, sibling);
+                    return parent;
+                }
+                Insert(pool, parent, IndexOf(pool.inners_[parent], node) + 1, sibling);
+            }
+            if (!parent) {
+                return node;
+            }
+            Adopt(pool, parent, IndexOf(pool.inners_[parent], node));
+            node = parent;
+        }
+    }
+
+    // Concatenates two trees given by their roots and returns the new root
+    static uint32_t Join(Pool& pool, uint32_t lhs, uint32_t rhs) {
+        if (!lhs || !rhs) {
+            return lhs ? lhs : rhs;
+        }
+        uint8_t lhs_height = pool.inners_[lhs].height_, rhs_height = pool.inners_[rhs].height_;
+        if (lhs_height == rhs_height) {
+            if (pool.inners_[lhs].size_ + pool.inners_[rhs].size_ <= kMaxChildren) {
+                MoveTail(pool, rhs, 0, lhs);
+                pool.inners_.Free(rhs);
+                return lhs;
+            }
+            Rebalance(pool, lhs, rhs);
+            uint32_t root = NewInner(pool, lhs_height + 1);
+            Insert(pool, root, 0, lhs);
+            Insert(pool, root, 1, rhs);
+            return root;
+        }
+        if (lhs_height > rhs_height) {
+            uint32_t node = lhs;
+            while (pool.inners_[node].height_ > rhs_height + 1) {
+                node = pool.inners_[node].children_[pool.inners_[node].size_ - 1];
+            }
+            Insert(pool, node, pool.inners_[node].size_, rhs);
+            FixShort(pool, node, pool.inners_[node].size_ - 2);
+            return Rise(pool, node);
+        }
+        uint32_t node = rhs;
+        while (pool.inners_[node].height_ > lhs_height + 1) {
+            node = pool.inners_[node].children_[0];
+        }
+        Insert(pool, node, 0, lhs);
+        FixShort(pool, node, 0);
+        return Rise(pool, node);
+    }
+
+    // Turns the node into a root, collapsing it if it has no or a single inner child
+    static uint32_t MakeRoot(Pool& pool, uint32_t node) {
+        Inner& inner = pool.inners_[node];
+        inner.parent_ = kNull;
+        if (inner.size_ == 0 || (inner.size_ == 1 && inner.height_ > 1)) {
+            uint32_t child = inner.size_ ? inner.children_[0] : kNull;
+            if (child) {
+                pool.inners_[child].parent_ = kNull;
+            }
+            pool.inners_.Free(node);
+            return child;
+        }
+        return node;
+    }
+
+    // Cuts the tree before the leaf and returns the roots of both parts
+    static std::pair<uint32_t, uint32_t> Split(Pool& pool, uint32_t leaf) {
+        uint32_t lhs = kNull, rhs = kNull;
+        uint32_t child = leaf, node = pool.leaves_[leaf].parent_;
+        // The children before the cut go to the left part, the rest except the already
+        // distributed child on the path go to the right one
+        uint32_t n_skipped = 0;
+        while (node) {
+            uint32_t parent = pool.inners_[node].parent_;
+            uint32_t pos = IndexOf(pool.inners_[node], child);
+            uint32_t left = NewInner(pool, pool.inners_[node].height_);
+            for (uint32_t i = 0; i < pos; ++i) {
+                Insert(pool, left, i, pool.inners_[node].children_[i]);
+            }
+            DropHead(pool.inners_[node], pos + n_skipped);
+            lhs = Join(pool, MakeRoot(pool, left), lhs);
+            rhs = Join(pool, rhs, MakeRoot(pool, node));
+            child = node;
+            node = parent;
+            n_skipped = 1;
+        }
+        return std::make_pair(lhs, rhs);
+    }
+};
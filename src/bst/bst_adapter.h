@@ -0,0 +1,182 @@
+#pragma once
+
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "bst_interface.h"
+
+// Whether the tree has index_of() and kth(). SkipListBST and BTreeBST count only vertices below a
+// node, so they cannot rank by all nodes and have neither
+template <class Tree, class = void>
+struct HasOrderStatistics : std::false_type {};
+
+template <class Tree>
+struct HasOrderStatistics<
+    Tree, std::void_t<decltype(std::declval<const Tree&>().kth(size_t(), bool()))>>
+    : std::true_type {};
+
+// Exposes a statically dispatched tree through the virtual IBST interface. The tree type
+// provides value_type, Pool, iterator, begin(), end(), merge(), merge_all(), a static
+// split_at() that fills a vector of parts, clear(), empty() and size();
+// its iterator provides the same operations as IBST<T>::iterator, is constructible from a pool,
+// a node index and the end flag, and gives them back through pool(), index() and is_end().
+// IBST has order statistics, so the tree must have index_of() and kth() too.
+//
+// Nodes belong to the pool, not to a handle. Splits and merges hand them from one handle to
+// another, and a split through an iterator leaves the old handle pointing into one of the
+// parts, so no handle can tell whether the nodes it points to are still its own. Dropping an
+// adapter therefore keeps its nodes in the pool; clear() on the last handle of a tree returns
+// them
+template <class Tree>
+class BSTAdapter : public IBST<typename Tree::value_type> {
+    static_assert(HasOrderStatistics<Tree>::value, "IBST needs index_of() and kth() of the tree");
+
+private:
+    typedef typename Tree::value_type T;
+    typedef typename Tree::iterator TreeIterator;
+    typedef typename Tree::Pool Pool;
+    typedef typename IBST<T>::Position Position;
+    typedef typename IBST<T>::IBSTItImpl BaseItImpl;
+
+    class AdapterItImpl : public BaseItImpl {
+    public:
+        static const AdapterItImpl* Instance() {
+            static const AdapterItImpl impl;
+            return &impl;
+        }
+
+        static Position Pack(const TreeIterator& it) {
+            return Position{it.pool(), it.index(), it.is_end()};
+        }
+        static TreeIterator Unpack(const Position& position) {
+            return TreeIterator(static_cast<Pool*>(position.pool_), position.node_,
+                                position.is_end_);
+        }
+
+        void Increment(Position& position) const override {
+            position = Pack(++Unpack(position));
+        }
+        void Decrement(Position& position) const override {
+            position = Pack(--Unpack(position));
+        }
+        void NextWithLevelEdges(Position& position) const override {
+            position = Pack(Unpack(position).next_with_level_edges());
+        }
+
+        const T Dereferencing(const Position& position) const override {
+            return *Unpack(position);
+        }
+        const T* Arrow(const Position& position) const override {
+            return Unpack(position).operator->();
+        }
+
+        Position FindRoot(const Position& position) const override {
+            return Pack(Unpack(position).get_root());
+        }
+
+        std::pair<std::shared_ptr<IBST<T>>, std::shared_ptr<IBST<T>>> Split(
+            const Position& position) const override {
+            auto tree_pair = Unpack(position).split();
+            return std::make_pair(std::make_shared<BSTAdapter>(tree_pair.first),
+                                  std::make_shared<BSTAdapter>(tree_pair.second));
+        }
+
+        void SetHasLevelEdges(const Position& position, bool has_level_edges) const override {
+            Unpack(position).set_has_level_edges(has_level_edges);
+        }
+        bool HasLevelEdges(const Position& position) const override {
+            return Unpack(position).has_level_edges();
+        }
+        void SetIsVertex(const Position& position, bool is_vertex) const override {
+            Unpack(position).set_is_vertex(is_vertex);
+        }
+    };
+
+public:
+    typedef typename IBST<T>::iterator iterator;
+
+    static_assert(std::is_trivially_copyable<iterator>::value,
+                  "IBST iterators are copied by value");
+
+    BSTAdapter() = delete;
+
+    template <class... Args>
+    explicit BSTAdapter(Args&&... args) : tree_(std::forward<Args>(args)...) {
+    }
+
+    // Leaves the nodes in the pool, see above
+    ~BSTAdapter() override = default;
+
+    Tree& get() {
+        return tree_;
+    }
+    const Tree& get() const {
+        return tree_;
+    }
+
+private:
+    Tree tree_;
+
+    iterator Begin(bool with_level_edges) const override {
+        return iterator(AdapterItImpl::Instance(),
+                        AdapterItImpl::Pack(tree_.begin(with_level_edges)));
+    }
+    iterator End() const override {
+        return iterator(AdapterItImpl::Instance(), AdapterItImpl::Pack(tree_.end()));
+    }
+
+    void Merge(std::shared_ptr<IBST<T>> other) override {
+        auto casted = std::dynamic_pointer_cast<BSTAdapter>(other);
+        if (!casted) {
+            throw std::logic_error("Cannot merge trees of different types");
+        }
+        tree_.merge(casted->tree_);
+    }
+    void MergeAll(const std::vector<std::shared_ptr<IBST<T>>>& others) override {
+        std::vector<Tree> trees;
+        trees.reserve(others.size());
+        for (const auto& other : others) {
+            auto casted = std::dynamic_pointer_cast<BSTAdapter>(other);
+            if (!casted) {
+                throw std::logic_error("Cannot merge trees of different types");
+            }
+            trees.emplace_back(casted->tree_);
+        }
+        tree_.merge_all(trees);
+    }
+    std::vector<std::shared_ptr<IBST<T>>> SplitAt(const std::vector<iterator>& points) override {
+        std::vector<TreeIterator> tree_points;
+        tree_points.reserve(points.size());
+        for (const auto& point : points) {
+            tree_points.emplace_back(AdapterItImpl::Unpack(this->PositionOf(point)));
+        }
+        std::vector<Tree> tree_parts;
+        Tree::split_at(tree_points, &tree_parts);
+        std::vector<std::shared_ptr<IBST<T>>> parts;
+        for (const auto& part : tree_parts) {
+            parts.emplace_back(std::make_shared<BSTAdapter>(part));
+        }
+        return parts;
+    }
+    void Clear() override {
+        tree_.clear();
+    }
+
+    bool IsEmpty() const override {
+        return tree_.empty();
+    }
+    size_t Size() const override {
+        return tree_.size();
+    }
+
+    size_t IndexOf(const iterator& it, bool only_vertices) const override {
+        return tree_.index_of(AdapterItImpl::Unpack(this->PositionOf(it)), only_vertices);
+    }
+    iterator Kth(size_t k, bool only_vertices) const override {
+        return iterator(AdapterItImpl::Instance(),
+                        AdapterItImpl::Pack(tree_.kth(k, only_vertices)));
+    }
+};
@@ -1,134 +1,152 @@
 #pragma once
 
 #include <cassert>
+#include <cstdint>
 #include <memory>
+#include <type_traits>
+#include <vector>
 
 template <class T>
 class IBST {
 protected:
     IBST() = default;
 
+    // Place of an iterator inside a tree: the node pool of the backend, an index of a node in
+    // it and the end flag
+    struct Position {
+        void* pool_;
+        uint32_t node_;
+        bool is_end_;
+    };
+
+    // Operations of a backend. Implementations are stateless and shared by all iterators
     class IBSTItImpl {
     public:
         virtual ~IBSTItImpl() = default;
 
-        virtual std::shared_ptr<IBSTItImpl> Clone() const = 0;
-
-        virtual void Increment() = 0;
-        virtual void Decrement() = 0;
-        virtual void NextWithLevelEdges() = 0;
+        virtual void Increment(Position& position) const = 0;
+        virtual void Decrement(Position& position) const = 0;
+        virtual void NextWithLevelEdges(Position& position) const = 0;
 
-        virtual const T Dereferencing() const = 0;
-        virtual const T* Arrow() const = 0;
+        virtual const T Dereferencing(const Position& position) const = 0;
+        virtual const T* Arrow(const Position& position) const = 0;
 
-        virtual bool IsEqual(std::shared_ptr<IBSTItImpl> other) const = 0;
+        virtual Position FindRoot(const Position& position) const = 0;
 
-        virtual std::shared_ptr<IBSTItImpl> FindRoot() const = 0;
+        virtual std::pair<std::shared_ptr<IBST<T>>, std::shared_ptr<IBST<T>>> Split(
+            const Position& position) const = 0;
 
-        virtual std::pair<std::shared_ptr<IBST<T>>, std::shared_ptr<IBST<T>>> Split() const = 0;
-
-        virtual void SetHasLevelEdges(bool has_level_edges) const = 0;
-        virtual void SetIsVertex(bool is_vertex) const = 0;
+        virtual void SetHasLevelEdges(const Position& position, bool has_level_edges) const = 0;
+        virtual bool HasLevelEdges(const Position& position) const = 0;
+        virtual void SetIsVertex(const Position& position, bool is_vertex) const = 0;
     };
 
-    virtual std::shared_ptr<IBSTItImpl> Begin(bool with_level_edges) const = 0;
-    virtual std::shared_ptr<IBSTItImpl> End() const = 0;
-
-    virtual void Merge(std::shared_ptr<IBST<T>> other) = 0;
-
-    virtual bool IsEmpty() const = 0;
-    virtual size_t Size() const = 0;
-
 public:
     virtual ~IBST() = default;
 
     class iterator {
     public:
         iterator() = default;
-        iterator(const iterator& other) : pimpl_(other.pimpl_->Clone()) {
-        }
-        explicit iterator(std::shared_ptr<IBSTItImpl> pimpl) : pimpl_(pimpl) {
-        }
-
-        ~iterator() = default;
-
-        iterator& operator=(const iterator& other) {
-            pimpl_ = other.pimpl_->Clone();
-            return *this;
+        iterator(const IBSTItImpl* impl, const Position& position)
+            : impl_(impl), position_(position) {
         }
 
         iterator& operator++() {
-            pimpl_->Increment();
+            impl_->Increment(position_);
             return *this;
         }
         iterator operator++(int) {
-            iterator cpy(pimpl_->Clone());
-            pimpl_->Increment();
+            iterator cpy(*this);
+            impl_->Increment(position_);
             return cpy;
         }
         iterator& next_with_level_edges() {
-            pimpl_->NextWithLevelEdges();
+            impl_->NextWithLevelEdges(position_);
             return *this;
         }
         iterator& operator--() {
-            pimpl_->Decrement();
+            impl_->Decrement(position_);
             return *this;
         }
         iterator operator--(int) {
-            iterator cpy(pimpl_->Clone());
-            pimpl_->Decrement();
+            iterator cpy(*this);
+            impl_->Decrement(position_);
             return cpy;
         }
 
         const T operator*() const {
-            return pimpl_->Dereferencing();
+            return impl_->Dereferencing(position_);
         }
         const T* operator->() const {
-            return pimpl_->Arrow();
+            return impl_->Arrow(position_);
         }
 
         bool operator==(const iterator& other) const {
-            return pimpl_->IsEqual(other.pimpl_);
+            return position_.node_ == other.position_.node_ &&
+                   position_.is_end_ == other.position_.is_end_ &&
+                   position_.pool_ == other.position_.pool_ && impl_ == other.impl_;
         }
         bool operator!=(const iterator& other) const {
-            return !pimpl_->IsEqual(other.pimpl_);
-        }
-
-        const std::shared_ptr<IBSTItImpl> get() const {
-            return pimpl_;
+            return !(*this == other);
         }
 
         iterator get_root() const {
-            return iterator(pimpl_->FindRoot());
+            return iterator(impl_, impl_->FindRoot(position_));
         }
 
         std::pair<std::shared_ptr<IBST<T>>, std::shared_ptr<IBST<T>>> split() const {
-            return pimpl_->Split();
+            return impl_->Split(position_);
         }
 
         void set_has_level_edges(bool has_level_edges) const {
-            pimpl_->SetHasLevelEdges(has_level_edges);
+            impl_->SetHasLevelEdges(position_, has_level_edges);
+        }
+
+        bool has_level_edges() const {
+            return impl_->HasLevelEdges(position_);
         }
 
         void set_is_vertex(bool is_vertex) const {
-            pimpl_->SetIsVertex(is_vertex);
+            impl_->SetIsVertex(position_, is_vertex);
         }
 
     private:
-        std::shared_ptr<IBSTItImpl> pimpl_;
+        friend class IBST;
+
+        const IBSTItImpl* impl_ = nullptr;
+        Position position_ = {nullptr, 0, true};
     };
 
     iterator begin(bool with_level_edges = false) const {
-        return iterator(Begin(with_level_edges));
+        return Begin(with_level_edges);
     }
     iterator end() const {
-        return iterator(End());
+        return End();
     }
 
     void merge(std::shared_ptr<IBST> other) {
         Merge(other);
     }
 
+    // Appends all the trees. The treap does it in one pass down the right spine of the result;
+    // the other backends merge them one by one, as a series of merge() calls
+    void merge_all(const std::vector<std::shared_ptr<IBST>>& others) {
+        MergeAll(others);
+    }
+
+    // Cuts the tree before each of the sorted points and returns the k + 1 parts. The tree
+    // must not be used afterwards. The treap climbs only the union of the root paths of the
+    // points; the other backends make one ordinary split per point, from the back
+    std::vector<std::shared_ptr<IBST>> split_at(const std::vector<iterator>& points) {
+        return SplitAt(points);
+    }
+
+    // Releases every node of the tree. Iterators into it become invalid. Destroying a tree does
+    // not release its nodes, since other trees may share them after splits and merges
+    void clear() {
+        Clear();
+    }
+
     bool empty() const {
         return IsEmpty();
     }
@@ -136,4 +154,33 @@ public:
     size_t size() const {
         return Size();
     }
+
+    // Number of nodes before the iterator, or of vertices only. The end iterator gets the total
+    size_t index_of(const iterator& it, bool only_vertices = false) const {
+        return IndexOf(it, only_vertices);
+    }
+
+    // The k-th node counting from zero, or the k-th vertex. Returns end() if there are fewer
+    iterator kth(size_t k, bool only_vertices = false) const {
+        return Kth(k, only_vertices);
+    }
+
+protected:
+    static const Position& PositionOf(const iterator& it) {
+        return it.position_;
+    }
+
+    virtual iterator Begin(bool with_level_edges) const = 0;
+    virtual iterator End() const = 0;
+
+    virtual void Merge(std::shared_ptr<IBST<T>> other) = 0;
+    virtual void MergeAll(const std::vector<std::shared_ptr<IBST<T>>>& others) = 0;
+    virtual std::vector<std::shared_ptr<IBST<T>>> SplitAt(const std::vector<iterator>& points) = 0;
+    virtual void Clear() = 0;
+
+    virtual bool IsEmpty() const = 0;
+    virtual size_t Size() const = 0;
+
+    virtual size_t IndexOf(const iterator& it, bool only_vertices) const = 0;
+    virtual iterator Kth(size_t k, bool only_vertices) const = 0;
 };
@@ -1,96 +1,148 @@
 #pragma once
 
-#include <exception>
+#include <algorithm>
 #include <initializer_list>
 #include <memory>
-#include <optional>
-#include <random>
+#include <stdexcept>
+#include <type_traits>
 #include <vector>
 
-template <class T>
-class IBST;
+#include "aggregates.h"
+#include "node_pool.h"
+#include "priority_generator.h"
+
+// Treap over an implicit key. All operations are statically dispatched; wrap it into
+// BSTAdapter to use it through IBST. Every node carries Flags independent flags, and each of
+// them can be searched for in O(log n). Flag 0 marks nodes with level edges. Nodes may also carry
+// payloads summed up by an Aggregate policy from aggregates.h. With CountWalks the tree counts
+// its root walks, see root_walks(); being part of the type, counting never reaches other trees
+template <class T, size_t Flags = 1, class Aggregate = NoAggregate, bool CountWalks = false>
+class CartesianBST {
+    static_assert(Flags >= 1 && Flags <= 7, "Flags of a node share a byte with its vertex bit");
 
-template <class T>
-class CartesianBST : public IBST<T> {
 private:
-    class Random {
-    public:
-        static uint32_t Next() {
-            static Random rand = Random();
-            return rand.dist_(rand.gen_);
-        }
+    static constexpr bool kAggregated = !std::is_same_v<Aggregate, NoAggregate>;
+    static constexpr uint32_t kVertexBit = 7;
+    static constexpr uint32_t kFlagBits = (1u << Flags) - 1;
+    // Set in subtree_flags_, whose top bit no flag uses, on the nodes a multi-point split has
+    // not updated yet; their update clears it
+    static constexpr uint8_t kPathMark = 1u << 7;
 
-    private:
-        Random() {
-            std::random_device device;
-            gen_ = std::mt19937(device());
-            dist_ =
-                std::uniform_int_distribution<uint32_t>(1, std::numeric_limits<uint32_t>::max());
+    // With 32-bit values a node takes 32 bytes for any number of flags: links are pool indices,
+    // the priority shares a word with the flags, and searches for a flag only need to know
+    // whether a subtree has it, one bit per flag
+    struct Node : AggregateFields<Aggregate> {
+        Node() : priority_(0), flags_(0) {
+        }
+        Node(const T& value, uint32_t priority)
+            : value_(value), priority_(priority >> 8), flags_(0) {
         }
 
-        std::mt19937 gen_;
-        std::uniform_int_distribution<uint32_t> dist_;
-    };
+        T value_ = T();
+        uint32_t left_ = 0;
+        uint32_t right_ = 0;
+        // Followed by concurrent readers
+        RelaxedAtomic<uint32_t> parent_ = 0;
+        uint32_t subtree_size_ = 1;
+        uint32_t child_count_ = 0;
+        // The top bits of a random priority, equal ones only cost a little balance
+        uint32_t priority_ : 24;
+        // The flags and, in the top bit, whether the node is a vertex occurrence
+        uint32_t flags_ : 8;
+        // The flags any node of the subtree has
+        uint8_t subtree_flags_ = 0;
 
-    struct Node {
-        Node() = delete;
-        Node(std::optional<T> value, uint32_t priority) : priority_(priority), value_(value) {
-            left_ = nullptr;
-            right_ = nullptr;
-            parent_ = std::weak_ptr<Node>();
-            child_count_ = 0;
-            child_with_level_edges_count_ = 0;
-        }
-
-        std::shared_ptr<Node> left_;
-        std::shared_ptr<Node> right_;
-        std::weak_ptr<Node> parent_;
-        uint32_t priority_;
-        uint32_t child_count_;
-        uint32_t child_with_level_edges_count_;
-        std::optional<T> value_;
+        bool HasFlag(size_t flag) const {
+            return (flags_ >> flag) & 1;
+        }
+        bool SubtreeHasFlag(size_t flag) const {
+            return (subtree_flags_ >> flag) & 1;
+        }
+        bool IsVertex() const {
+            return (flags_ >> kVertexBit) & 1;
+        }
+        void SetIsVertex(bool is_vertex) {
+            flags_ = (flags_ & ~(1u << kVertexBit)) |
+                     (static_cast<uint32_t>(is_vertex) << kVertexBit);
+        }
     };
 
-    typedef typename IBST<T>::IBSTItImpl BaseItImpl;
+public:
+    typedef T value_type;
+    typedef NodePool<Node> Pool;
 
-    class CartesianBSTItImpl : public BaseItImpl {
-    public:
-        CartesianBSTItImpl() = delete;
-        CartesianBSTItImpl(std::shared_ptr<Node> pointer, bool is_end = false,
-                           bool with_level_edges = false)
-            : it_(pointer), is_end_(is_end) {
-            if (with_level_edges && !is_end) {
-                size_t own_edges_count =
-                    it_->child_with_level_edges_count_ -
-                    (it_->left_ ? it_->left_->child_with_level_edges_count_ : 0) -
-                    (it_->right_ ? it_->right_->child_with_level_edges_count_ : 0);
-                if (!own_edges_count) {
-                    NextWithLevelEdges();
-                }
-            }
+    typedef typename Aggregate::value_type Payload;
+
+    static constexpr size_t kFlags = Flags;
+
+    // Shape of one tree or of several, with the invariants found broken
+    struct Shape {
+        size_t n_nodes_ = 0;
+        std::vector<size_t> tree_sizes_;
+        // Nodes at each depth, roots are at depth 0
+        std::vector<size_t> depth_counts_;
+        size_t total_depth_ = 0;
+        // Children with a higher priority than their parent
+        size_t heap_violations_ = 0;
+        // Children whose parent link is wrong, roots with a parent, and cycles
+        size_t link_violations_ = 0;
+        // Nodes whose sizes or subtree flags disagree with their children
+        size_t count_violations_ = 0;
+
+        size_t height() const {
+            return depth_counts_.size();
         }
-        CartesianBSTItImpl(const CartesianBSTItImpl& other)
-            : it_(other.it_), is_end_(other.is_end_) {
+        double average_depth() const {
+            return n_nodes_ ? static_cast<double>(total_depth_) / n_nodes_ : 0;
         }
+        bool is_valid() const {
+            return !heap_violations_ && !link_violations_ && !count_violations_;
+        }
+
+        void merge(const Shape& other) {
+            n_nodes_ += other.n_nodes_;
+            tree_sizes_.insert(tree_sizes_.end(), other.tree_sizes_.begin(),
+                               other.tree_sizes_.end());
+            if (depth_counts_.size() < other.depth_counts_.size()) {
+                depth_counts_.resize(other.depth_counts_.size());
+            }
+            for (size_t depth = 0; depth < other.depth_counts_.size(); ++depth) {
+                depth_counts_[depth] += other.depth_counts_[depth];
+            }
+            total_depth_ += other.total_depth_;
+            heap_violations_ += other.heap_violations_;
+            link_violations_ += other.link_violations_;
+            count_violations_ += other.count_violations_;
+        }
+    };
+
+private:
+    static constexpr uint32_t kNull = Pool::kNull;
 
-        std::shared_ptr<BaseItImpl> Clone() const override {
-            return std::make_shared<CartesianBSTItImpl>(*this);
+public:
+    class iterator {
+    public:
+        iterator() : pool_(nullptr), it_(kNull), is_end_(true) {
+        }
+        iterator(Pool* pool, uint32_t pointer, bool is_end = false)
+            : pool_(pool), it_(pointer), is_end_(is_end) {
         }
 
-        void Increment() override {
+        iterator& operator++() {
             if (is_end_) {
                 throw std::runtime_error("Index out of range while increasing");
             }
-            if (it_->right_) {
-                it_ = it_->right_;
-                while (it_->left_) {
-                    it_ = it_->left_;
+            const Pool& pool = *pool_;
+            if (pool[it_].right_) {
+                it_ = pool[it_].right_;
+                while (pool[it_].left_) {
+                    it_ = pool[it_].left_;
                 }
             } else {
-                auto parent = it_->parent_.lock(), start = it_;
-                while (parent && parent->right_ == it_) {
+                uint32_t parent = pool[it_].parent_, start = it_;
+                while (parent && pool[parent].right_ == it_) {
                     it_ = parent;
-                    parent = it_->parent_.lock();
+                    parent = pool[it_].parent_;
                 }
                 if (parent) {
                     it_ = parent;
@@ -99,25 +151,55 @@ private:
                     is_end_ = true;
                 }
             }
+            return *this;
         }
-        void Decrement() override {
+        iterator operator++(int) {
+            iterator cpy(*this);
+            ++*this;
+            return cpy;
+        }
+        // Moves to the next node with the flag, skipping unflagged subtrees
+        iterator& next_flagged(size_t flag) {
+            if (is_end_) {
+                throw std::runtime_error("Index out of range while increasing");
+            }
+            const Pool& pool = *pool_;
+            uint32_t next = NextFlagged(pool, it_, flag);
+            if (next) {
+                it_ = next;
+                return *this;
+            }
+            // End iterators point to the last node of the tree
+            uint32_t cur = find_root(pool, it_);
+            while (pool[cur].right_) {
+                cur = pool[cur].right_;
+            }
+            it_ = cur;
+            is_end_ = true;
+            return *this;
+        }
+        iterator& next_with_level_edges() {
+            return next_flagged(0);
+        }
+        iterator& operator--() {
             if (is_end_) {
                 if (!it_) {
                     throw std::runtime_error("Index out of range while decreasing");
                 }
                 is_end_ = false;
-                return;
+                return *this;
             }
-            if (it_->left_) {
-                it_ = it_->left_;
-                while (it_->right_) {
-                    it_ = it_->right_;
+            const Pool& pool = *pool_;
+            if (pool[it_].left_) {
+                it_ = pool[it_].left_;
+                while (pool[it_].right_) {
+                    it_ = pool[it_].right_;
                 }
             } else {
-                auto parent = it_->parent_.lock();
-                while (parent && parent->left_ == it_) {
+                uint32_t parent = pool[it_].parent_;
+                while (parent && pool[parent].left_ == it_) {
                     it_ = parent;
-                    parent = it_->parent_.lock();
+                    parent = pool[it_].parent_;
                 }
                 if (parent) {
                     it_ = parent;
@@ -125,259 +207,524 @@ private:
                     throw std::runtime_error("Index out of range while decreasing");
                 }
             }
+            return *this;
         }
-        void NextWithLevelEdges() override {
-            if (is_end_) {
-                throw std::runtime_error("Index out of range while increasing");
-            }
-            if (it_->right_ && it_->right_->child_with_level_edges_count_) {
-                it_ = it_->right_;
-                if (it_->left_ && it_->left_->child_with_level_edges_count_) {
-                    it_ = it_->left_;
-                }
-                size_t own_edges_count =
-                    it_->child_with_level_edges_count_ -
-                    (it_->left_ ? it_->left_->child_with_level_edges_count_ : 0) -
-                    (it_->right_ ? it_->right_->child_with_level_edges_count_ : 0);
-                if (!own_edges_count) {
-                    NextWithLevelEdges();
-                }
-            } else {
-                auto parent = it_->parent_.lock(), start = it_;
-                while (parent && parent->right_ == it_) {
-                    it_ = parent;
-                    parent = it_->parent_.lock();
-                }
-                if (parent) {
-                    it_ = parent;
-                    size_t own_edges_count =
-                        it_->child_with_level_edges_count_ -
-                        it_->left_->child_with_level_edges_count_ -
-                        (it_->right_ ? it_->right_->child_with_level_edges_count_ : 0);
-                    if (!own_edges_count) {
-                        NextWithLevelEdges();
-                    }
-                } else {
-                    it_ = start;
-                    is_end_ = true;
-                }
-            }
+        iterator operator--(int) {
+            iterator cpy(*this);
+            --*this;
+            return cpy;
         }
 
-        const T Dereferencing() const override {
+        const T operator*() const {
             if (is_end_) {
                 throw std::runtime_error("Index out of range in operator*");
             }
-            return *(it_->value_);
+            return Nodes()[it_].value_;
         }
-        const T* Arrow() const override {
+        const T* operator->() const {
             if (is_end_) {
                 throw std::runtime_error("Index out of range in operator->");
             }
-            return &(*it_->value_);
+            return &Nodes()[it_].value_;
         }
 
-        bool IsEqual(std::shared_ptr<BaseItImpl> other) const override {
-            auto casted = std::dynamic_pointer_cast<CartesianBSTItImpl>(other);
-            if (!casted) {
-                return false;
-            }
-            return it_ == casted->it_ && is_end_ == casted->is_end_;
+        bool operator==(const iterator& other) const {
+            return it_ == other.it_ && is_end_ == other.is_end_ && pool_ == other.pool_;
+        }
+        bool operator!=(const iterator& other) const {
+            return !(*this == other);
         }
 
-        std::shared_ptr<BaseItImpl> FindRoot() const override {
-            auto it = it_;
-            while (!it->parent_.expired()) {
-                it = it->parent_.lock();
-            }
-            return std::make_shared<CartesianBSTItImpl>(it);
+        iterator get_root() const {
+            return iterator(pool_, find_root(Nodes(), it_));
         }
 
-        std::pair<std::shared_ptr<IBST<T>>, std::shared_ptr<IBST<T>>> Split() const override {
+        std::pair<CartesianBST, CartesianBST> split() const {
             if (is_end_) {
                 throw std::logic_error("Cannot split in empty parts");
             }
-            std::shared_ptr<Node> rhs = it_;
-            std::shared_ptr<Node> lhs = rhs->left_;
-            if (lhs) {
-                rhs->child_count_ -= lhs->child_count_;
-                rhs->child_with_level_edges_count_ -= lhs->child_with_level_edges_count_;
-                lhs->parent_ = std::weak_ptr<Node>();
-            }
-            rhs->left_ = nullptr;
-            std::shared_ptr<Node> from = rhs->parent_.lock();
-            while (from) {
-                // The order here is important. We should look at rhs first
-                if (from->right_ == rhs) {
-                    if (rhs) {
-                        from->child_count_ -= rhs->child_count_;
-                        from->child_with_level_edges_count_ -= rhs->child_with_level_edges_count_;
-                        rhs->parent_ = std::weak_ptr<Node>();
-                    }
-                    from->right_ = lhs;
-                    if (lhs) {
-                        from->child_count_ += lhs->child_count_;
-                        from->child_with_level_edges_count_ += lhs->child_with_level_edges_count_;
-                        lhs->parent_ = from;
-                    }
-                    lhs = from;
-                } else if (from->left_ == rhs) {
-                    rhs = from;
-                } else if (from->right_ == lhs) {
-                    lhs = from;
-                } else if (from->left_ == lhs) {
-                    if (lhs) {
-                        from->child_count_ -= lhs->child_count_;
-                        from->child_with_level_edges_count_ -= lhs->child_with_level_edges_count_;
-                        lhs->parent_ = std::weak_ptr<Node>();
-                    }
-                    from->left_ = rhs;
-                    if (rhs) {
-                        from->child_count_ += rhs->child_count_;
-                        from->child_with_level_edges_count_ += rhs->child_with_level_edges_count_;
-                        rhs->parent_ = from;
-                    }
-                    rhs = from;
-                } else {
-                    throw std::logic_error("Impossible behaviour");
+            WriteSection<Pool> section(*pool_);
+            auto roots = SplitBefore(*pool_, it_);
+            return std::make_pair(CartesianBST(pool_, roots.first),
+                                  CartesianBST(pool_, roots.second));
+        }
+
+        void set_flag(size_t flag, bool value) const {
+            if (Nodes()[it_].HasFlag(flag) == value) {
+                return;
+            }
+            Pool& pool = *pool_;
+            pool[it_].flags_ ^= 1u << flag;
+            // Stops at the first subtree whose flags stay the same, as do all above it
+            for (uint32_t from = it_; from; from = pool[from].parent_) {
+                uint8_t flags = SubtreeFlags(pool, pool[from]);
+                if (flags == pool[from].subtree_flags_) {
+                    break;
                 }
-                from = from->parent_.lock();
+                pool[from].subtree_flags_ = flags;
             }
-            return std::make_pair(std::make_shared<CartesianBST<T>>(lhs),
-                                  std::make_shared<CartesianBST<T>>(rhs));
         }
 
-        void SetHasLevelEdges(bool has_level_edges) const override {
-            size_t child_level_edges =
-                (it_->left_ ? it_->left_->child_with_level_edges_count_ : 0) +
-                (it_->right_ ? it_->right_->child_with_level_edges_count_ : 0);
-            int add = static_cast<int>(has_level_edges) -
-                      static_cast<int>(it_->child_with_level_edges_count_ - child_level_edges);
-            std::shared_ptr<Node> from = it_;
-            while (from) {
-                from->child_with_level_edges_count_ += add;
-                from = from->parent_.lock();
+        bool has_flag(size_t flag) const {
+            return Nodes()[it_].HasFlag(flag);
+        }
+
+        // Point update of the payload, O(log n)
+        void set_payload(const Payload& payload) const {
+            static_assert(kAggregated, "The tree has no aggregate");
+            Pool& pool = *pool_;
+            pool[it_].payload_ = payload;
+            for (uint32_t from = it_; from; from = pool[from].parent_) {
+                UpdateAggregate(pool, from);
             }
         }
 
-        void SetIsVertex(bool is_vertex) const override {
-            size_t children_child_count = (it_->left_ ? it_->left_->child_count_ : 0) +
-                                          (it_->right_ ? it_->right_->child_count_ : 0);
-            int add = static_cast<int>(is_vertex) -
-                      static_cast<int>(it_->child_count_ - children_child_count);
-            std::shared_ptr<Node> from = it_;
-            while (from) {
-                from->child_count_ += add;
-                from = from->parent_.lock();
+        Payload payload() const {
+            static_assert(kAggregated, "The tree has no aggregate");
+            return Nodes()[it_].payload_;
+        }
+
+        // Aggregate of the whole tree holding the node
+        Payload tree_aggregate() const {
+            static_assert(kAggregated, "The tree has no aggregate");
+            return Nodes()[find_root(Nodes(), it_)].aggregate_;
+        }
+
+        void set_has_level_edges(bool has_level_edges) const {
+            set_flag(0, has_level_edges);
+        }
+
+        bool has_level_edges() const {
+            return has_flag(0);
+        }
+
+        void set_is_vertex(bool is_vertex) const {
+            int add = static_cast<int>(is_vertex) - static_cast<int>(Nodes()[it_].IsVertex());
+            if (!add) {
+                return;
+            }
+            Pool& pool = *pool_;
+            pool[it_].SetIsVertex(is_vertex);
+            for (uint32_t from = it_; from; from = pool[from].parent_) {
+                pool[from].child_count_ += add;
             }
         }
 
+        Pool* pool() const {
+            return pool_;
+        }
+        uint32_t index() const {
+            return it_;
+        }
+        bool is_end() const {
+            return is_end_;
+        }
+
+        // Number of links up to the root
+        size_t depth() const {
+            const Pool& pool = *pool_;
+            size_t depth = 0;
+            for (uint32_t node = it_; node && pool[node].parent_; node = pool[node].parent_) {
+                ++depth;
+            }
+            return depth;
+        }
+
     private:
-        std::shared_ptr<Node> it_;
+        Pool* pool_;
+        uint32_t it_;
         bool is_end_;
+
+        // Read-only access, which does not copy blocks shared with snapshots
+        const Pool& Nodes() const {
+            return *pool_;
+        }
     };
 
-public:
     CartesianBST() = delete;
 
-    explicit CartesianBST(std::shared_ptr<Node> root) : root_(root) {
-        RecalcBeginEnd();
+    // Root of the tree holding the node. Works on a pool, on its snapshots and on its ReadView
+    template <class Nodes>
+    static uint32_t find_root(const Nodes& nodes, uint32_t node) {
+        CountRootWalk();
+        while (nodes[node].parent_) {
+            node = nodes[node].parent_;
+        }
+        return node;
+    }
+
+    // The same from any thread while one writer splits and merges trees of the pool
+    static uint32_t find_root_concurrent(const Pool& pool, uint32_t node) {
+        return pool.ReadConsistent(
+            [node](const typename Pool::ReadView& nodes) { return find_root(nodes, node); });
+    }
+
+    static constexpr bool kCountsRootWalks = CountWalks;
+
+    // Walks along a root path by splits, merges and root lookups on the calling thread. Stays 0
+    // unless the tree has CountWalks, as in the benchmarks
+    static uint64_t& root_walks() {
+        thread_local uint64_t walks = 0;
+        return walks;
+    }
+
+    // A handle is a bare root; the first and the last nodes are found when first asked for
+    CartesianBST(Pool* pool, uint32_t root) : pool_(pool), root_(root) {
     }
 
     template <class InitIterator>
-    CartesianBST(InitIterator begin, InitIterator end) {
-        if (begin == end) {
-            begin_ = end_ = root_ = nullptr;
-            is_empty_ = true;
-            return;
+    CartesianBST(InitIterator begin, InitIterator end, Pool& pool = Pool::Default())
+        : CartesianBST(begin, end, NoFlags(), pool) {
+    }
+
+    // Marks the nodes for which the flags sequence is true as vertices
+    template <class InitIterator, class FlagIterator>
+    CartesianBST(InitIterator begin, InitIterator end, FlagIterator is_vertex, Pool& pool)
+        : CartesianBST(begin, end, is_vertex, pool, [](uint32_t) {}) {
+    }
+    // Also passes the node of every value to on_node, in order
+    template <class InitIterator, class FlagIterator, class NodeVisitor>
+    CartesianBST(InitIterator begin, InitIterator end, FlagIterator is_vertex, Pool& pool,
+                 NodeVisitor on_node)
+        : pool_(&pool), root_(MakeLinear(pool, begin, end, is_vertex, on_node)) {
+    }
+
+    CartesianBST(const CartesianBST& other) = default;
+    CartesianBST& operator=(const CartesianBST& other) = default;
+
+    ~CartesianBST() = default;
+
+    iterator begin(bool with_level_edges = false) const {
+        if (!root_) {
+            return end();
+        }
+        if (with_level_edges) {
+            return begin_flagged(0);
         }
-        std::vector<uint32_t> priorities;
-        for (InitIterator cur(begin); cur != end; ++cur) {
-            priorities.emplace_back(Random::Next());
+        if (!begin_) {
+            begin_ = Extreme(&Node::left_);
         }
-        MakeRecursive(root_, begin, end, priorities.begin(), priorities.end());
-        RecalcBeginEnd();
+        return iterator(pool_, begin_);
     }
-
-    CartesianBST(CartesianBST&& other) noexcept : CartesianBST() {
-        std::swap(root_, other.root_);
-        std::swap(begin_, other.begin_);
-        std::swap(end_, other.end_);
-        std::swap(is_empty_, other.is_empty_);
+    // The first node with the flag, or end()
+    iterator begin_flagged(size_t flag) const {
+        const Pool& pool = *pool_;
+        if (!root_ || !pool[root_].SubtreeHasFlag(flag)) {
+            return end();
+        }
+        return iterator(pool_, LeftmostFlagged(pool, root_, flag));
     }
-    CartesianBST(std::shared_ptr<IBST<T>> other)
-        : CartesianBST(*std::dynamic_pointer_cast<CartesianBST<T>>(other)) {
+    iterator end() const {
+        if (root_ && !end_) {
+            end_ = Extreme(&Node::right_);
+        }
+        return iterator(pool_, end_, true);
     }
 
-    CartesianBST& operator=(CartesianBST&& other) noexcept {
-        if (root_ == other.root_) {
-            return *this;
+    // What get_root() of any of its nodes returns, without walking up to it
+    iterator get_root() const {
+        return iterator(pool_, root_);
+    }
+
+    // Appends the other tree. The other handle must not be used afterwards
+    void merge(CartesianBST other) {
+        if (!other.root_) {
+            return;
+        }
+        if (!root_) {
+            *this = other;
+            return;
         }
-        std::swap(root_, other.root_);
-        std::swap(begin_, other.begin_);
-        std::swap(end_, other.end_);
-        std::swap(is_empty_, other.is_empty_);
-        return *this;
+        if (pool_ != other.pool_) {
+            throw std::logic_error("Cannot merge trees from different pools");
+        }
+        WriteSection<Pool> section(*pool_);
+        end_ = other.end_;
+        root_ = MergeIterative(*pool_, root_, other.root_);
     }
 
-    ~CartesianBST() override {
-        root_ = begin_ = end_ = nullptr;
+    // Appends all the trees in one pass down the right spine of the result. Each tree goes
+    // below the lowest spine node of a higher priority, found from where the previous one went
+    // rather than from the root, and the spine nodes it passes get their counts once, when
+    // they leave the spine or at the end. Their handles must not be used afterwards
+    void merge_all(const std::vector<CartesianBST>& others) {
+        MergeAll(others.begin(), others.end());
+    }
+    // The same for a braced list of trees, which needs no vector
+    void merge_all(std::initializer_list<CartesianBST> others) {
+        MergeAll(others.begin(), others.end());
     }
 
-private:
-    std::shared_ptr<Node> begin_;
-    std::shared_ptr<Node> end_;
-    std::shared_ptr<Node> root_;
-    bool is_empty_;
+    // Cuts the tree holding the points before each of them and puts the k + 1 parts into parts.
+    // Points are sorted nodes of one tree; repeated points and end() give empty parts. Cuts run
+    // from the back, and the nodes a cut leaves on the right spine of the rest are marked
+    // instead of updated: the next cut stops climbing where it meets them, and they get their
+    // counts once, when they leave that spine or at the end. So the cuts climb the union of
+    // their root paths, O(k log(n / k)), not k whole paths. The walks saved are mostly cache
+    // hits, so on random cuts it runs within 7% of the series. Reusing the vector of parts makes
+    // repeated cuts allocate nothing
+    static void split_at(const std::vector<iterator>& points, std::vector<CartesianBST>* parts) {
+        if (points.empty()) {
+            throw std::logic_error("Nothing to split at");
+        }
+        Pool* pool = points.front().pool();
+        for (const auto& point : points) {
+            if (point.pool() != pool) {
+                throw std::logic_error("Cannot split trees from different pools");
+            }
+        }
+        // The cuts share one write section, so readers wait for all of them once
+        WriteSection<Pool> section(*pool);
+        parts->assign(points.size() + 1, CartesianBST(pool, kNull));
+        // The root of the rest and its lowest marked node
+        uint32_t root = kNull, marked = kNull;
+        bool is_cut = false;
+        for (size_t i = points.size(); i-- > 0;) {
+            if (points[i].is_end() || (i + 1 < points.size() && points[i] == points[i + 1])) {
+                continue;
+            }
+            uint32_t part = CutMarked(*pool, points[i].index(), &root, &marked);
+            (*parts)[i + 1] = CartesianBST(pool, part);
+            is_cut = true;
+        }
+        if (!is_cut) {
+            uint32_t node = points.front().index();
+            root = node ? find_root(*pool, node) : kNull;
+        }
+        for (; marked; marked = (*pool)[marked].parent_) {
+            Update(*pool, marked);
+        }
+        (*parts)[0] = CartesianBST(pool, root);
+    }
 
-    void Merge(std::shared_ptr<IBST<T>> other) override {
-        if (other->empty()) {
+    // Calls the visitor with the value of every node with the flag, in order. One walk down the
+    // paths to the k flagged nodes, pruned by the subtree flags: O(k log(n / k)), no iterators.
+    // The visitor must not change the tree
+    template <class Visitor>
+    void for_each_flagged(size_t flag, Visitor visitor) const {
+        const Pool& pool = *pool_;
+        if (!root_ || !pool[root_].SubtreeHasFlag(flag)) {
             return;
         }
-        auto other_cast = std::dynamic_pointer_cast<CartesianBST<T>>(other);
-        if (is_empty_) {
-            *this = std::move(*other_cast);
-            return;
+        for (uint32_t node = LeftmostFlagged(pool, root_, flag); node;
+             node = NextFlagged(pool, node, flag)) {
+            visitor(pool[node].value_);
+        }
+    }
+
+    // Appends the values of the nodes with the flag to out
+    void collect_flagged(size_t flag, std::vector<T>* out) const {
+        for_each_flagged(flag, [out](const T& value) { out->push_back(value); });
+    }
+
+    // Releases every node of the tree. Iterators into it become invalid
+    void clear() {
+        Pool& pool = *pool_;
+        WriteSection<Pool> section(pool);
+        uint32_t cur = root_;
+        while (cur) {
+            Node& node = pool[cur];
+            if (node.left_) {
+                cur = node.left_;
+                node.left_ = kNull;
+            } else if (node.right_) {
+                cur = node.right_;
+                node.right_ = kNull;
+            } else {
+                uint32_t parent = node.parent_;
+                pool.Free(cur);
+                cur = parent;
+            }
         }
-        end_ = other_cast->end_;
-        root_ = CartesianBST<T>::MergeRecursive(root_, other_cast->root_);
+        begin_ = end_ = root_ = kNull;
     }
 
-    bool IsEmpty() const override {
-        return is_empty_;
+    bool empty() const {
+        return !root_;
     }
 
-    size_t Size() const override {
-        return root_->child_count_;
+    size_t size() const {
+        return !root_ ? 0 : static_cast<const Pool&>(*pool_)[root_].child_count_;
     }
 
-    std::shared_ptr<BaseItImpl> Begin(bool with_level_edges) const override {
-        if (is_empty_) {
-            return std::make_shared<CartesianBSTItImpl>(end_, true);
+    Payload aggregate() const {
+        static_assert(kAggregated, "The tree has no aggregate");
+        if (!root_) {
+            return Aggregate::Identity();
         }
-        return std::make_shared<CartesianBSTItImpl>(begin_, false, with_level_edges);
+        return static_cast<const Pool&>(*pool_)[root_].aggregate_;
     }
-    std::shared_ptr<BaseItImpl> End() const override {
-        return std::make_shared<CartesianBSTItImpl>(end_, true);
+
+    // Number of nodes before the iterator, or of vertices only. The end iterator gets the total
+    size_t index_of(const iterator& it, bool only_vertices = false) const {
+        uint32_t node = it.index();
+        if (!node) {
+            return 0;
+        }
+        const Pool& pool = *it.pool();
+        size_t index = it.is_end() ? Weight(pool[node], only_vertices) : 0;
+        if (pool[node].left_) {
+            index += Count(pool[pool[node].left_], only_vertices);
+        }
+        for (uint32_t parent = pool[node].parent_; parent; parent = pool[node].parent_) {
+            if (pool[parent].right_ == node) {
+                index += Weight(pool[parent], only_vertices);
+                if (pool[parent].left_) {
+                    index += Count(pool[pool[parent].left_], only_vertices);
+                }
+            }
+            node = parent;
+        }
+        return index;
     }
 
-    void RecalcBeginEnd() {
+    // The k-th node counting from zero, or the k-th vertex. Returns end() if there are fewer
+    iterator kth(size_t k, bool only_vertices = false) const {
+        const Pool& pool = *pool_;
+        if (!root_ || k >= Count(pool[root_], only_vertices)) {
+            return end();
+        }
+        uint32_t node = root_;
+        while (true) {
+            uint32_t left = pool[node].left_;
+            size_t left_count = left ? Count(pool[left], only_vertices) : 0;
+            if (k < left_count) {
+                node = left;
+                continue;
+            }
+            k -= left_count;
+            size_t weight = Weight(pool[node], only_vertices);
+            if (k < weight) {
+                return iterator(pool_, node);
+            }
+            k -= weight;
+            node = pool[node].right_;
+        }
+    }
+
+    // Walks the whole tree, O(n). Does not trust the links: cycles end the walk
+    Shape shape() const {
+        Shape shape;
         if (!root_) {
-            begin_ = end_ = root_;
-            is_empty_ = true;
+            return shape;
+        }
+        const Pool& pool = *pool_;
+        shape.link_violations_ += pool[root_].parent_ != kNull;
+        std::vector<std::pair<uint32_t, size_t>> stack = {{root_, 0}};
+        while (!stack.empty()) {
+            auto [node, depth] = stack.back();
+            stack.pop_back();
+            if (shape.n_nodes_++ > pool.Used()) {
+                ++shape.link_violations_;
+                break;
+            }
+            if (shape.depth_counts_.size() == depth) {
+                shape.depth_counts_.emplace_back(0);
+            }
+            ++shape.depth_counts_[depth];
+            shape.total_depth_ += depth;
+            shape.count_violations_ += !HasValidCounts(pool, node);
+            for (uint32_t child : {pool[node].left_, pool[node].right_}) {
+                if (child) {
+                    shape.link_violations_ += pool[child].parent_ != node;
+                    shape.heap_violations_ += pool[child].priority_ > pool[node].priority_;
+                    stack.emplace_back(child, depth + 1);
+                }
+            }
+        }
+        shape.tree_sizes_.emplace_back(shape.n_nodes_);
+        return shape;
+    }
+
+    // Average depth of nodes at evenly spaced positions, O(samples log n). Cheap enough to
+    // watch the balance of live trees
+    double sample_depth(size_t n_samples) const {
+        size_t size = root_ ? static_cast<const Pool&>(*pool_)[root_].subtree_size_ : 0;
+        n_samples = std::min(n_samples, size);
+        if (!n_samples) {
+            return 0;
+        }
+        size_t total = 0;
+        for (size_t i = 0; i < n_samples; ++i) {
+            total += kth(i * size / n_samples).depth();
+        }
+        return static_cast<double>(total) / n_samples;
+    }
+
+private:
+    Pool* pool_;
+    uint32_t root_;
+    // The first and the last nodes, kNull until asked for
+    mutable uint32_t begin_ = kNull;
+    mutable uint32_t end_ = kNull;
+
+    template <class TreeIterator>
+    void MergeAll(TreeIterator first, TreeIterator last) {
+        for (; first != last && !root_; ++first) {
+            *this = *first;
+        }
+        for (TreeIterator it = first; it != last; ++it) {
+            if (it->root_ && it->pool_ != pool_) {
+                throw std::logic_error("Cannot merge trees from different pools");
+            }
+        }
+        if (first == last) {
             return;
         }
-        std::shared_ptr<Node> cur_node = root_;
-        while (cur_node->left_) {
-            cur_node = cur_node->left_;
+        Pool& pool = *pool_;
+        WriteSection<Pool> section(pool);
+        // The pass down the spine is one walk, and so is every zip below
+        CountRootWalk();
+        // The lowest spine node walked so far; parent links lead up the rest of the walk
+        uint32_t spine = root_;
+        for (; first != last; ++first) {
+            uint32_t root = first->root_;
+            if (!root) {
+                continue;
+            }
+            // Ties go to the later tree, as in MergeIterative
+            uint32_t priority = pool[root].priority_, zipped = kNull;
+            while (spine && pool[spine].priority_ <= priority) {
+                zipped = spine;
+                spine = pool[spine].parent_;
+                Update(pool, zipped);
+            }
+            if (!zipped) {
+                while (pool[spine].right_ && pool[pool[spine].right_].priority_ > priority) {
+                    spine = pool[spine].right_;
+                }
+                zipped = pool[spine].right_;
+            }
+            if (zipped && !pool[root].left_) {
+                // A tree without a left spine has nothing to zip with
+                pool[root].left_ = zipped;
+                pool[zipped].parent_ = root;
+                Update(pool, root);
+            } else if (zipped) {
+                pool[zipped].parent_ = kNull;
+                root = MergeIterative(pool, zipped, root);
+            }
+            if (spine) {
+                pool[spine].right_ = root;
+            } else {
+                root_ = root;
+            }
+            pool[root].parent_ = spine;
+            spine = root;
+            end_ = first->end_;
+        }
+        for (; spine; spine = pool[spine].parent_) {
+            Update(pool, spine);
         }
-        begin_ = cur_node;
-        cur_node = root_;
-        while (cur_node->right_) {
-            cur_node = cur_node->right_;
+    }
+
+    uint32_t Extreme(uint32_t Node::*side) const {
+        const Pool& pool = *pool_;
+        uint32_t node = root_;
+        while (pool[node].*side) {
+            node = pool[node].*side;
         }
-        end_ = cur_node;
-        is_empty_ = false;
+        return node;
     }
 
     /* ---------------------------------------------------
@@ -385,60 +732,318 @@ private:
      * ---------------------------------------------------
      */
 
-    template <class InitIterator, class PriorityIterator>
-    static void MakeRecursive(std::shared_ptr<Node>& from, InitIterator begin, InitIterator end,
-                              PriorityIterator pbegin, PriorityIterator pend) {
-        if (begin == end) {
-            return;
+    static void CountRootWalk() {
+        if constexpr (CountWalks) {
+            ++root_walks();
+        }
+    }
+
+    // Cuts the tree before the node, returns the roots of both parts
+    static std::pair<uint32_t, uint32_t> SplitBefore(Pool& pool, uint32_t node) {
+        CountRootWalk();
+        uint32_t rhs = node;
+        uint32_t lhs = pool[rhs].left_;
+        if (lhs) {
+            pool[lhs].parent_ = kNull;
         }
-        PriorityIterator pmax(pbegin);
-        InitIterator cur(begin), vmax(begin);
-        for (PriorityIterator pcur(pbegin); pcur != pend; ++pcur, ++cur) {
-            if (*pcur > *pmax) {
-                pmax = pcur;
-                vmax = cur;
+        pool[rhs].left_ = kNull;
+        Update(pool, rhs);
+        // Every ancestor goes to the side opposite to the child we came from
+        uint32_t from = rhs, parent = pool[rhs].parent_;
+        while (parent) {
+            uint32_t next = pool[parent].parent_;
+            if (pool[parent].right_ == from) {
+                pool[parent].right_ = lhs;
+                if (lhs) {
+                    pool[lhs].parent_ = parent;
+                }
+                lhs = parent;
+            } else {
+                pool[parent].left_ = rhs;
+                pool[rhs].parent_ = parent;
+                rhs = parent;
             }
+            Update(pool, parent);
+            from = parent;
+            parent = next;
         }
-        from = std::make_shared<Node>(*vmax, *pmax);
-        if (cur == begin && ++cur == end) {
-            return;
+        pool[rhs].parent_ = kNull;
+        if (lhs) {
+            pool[lhs].parent_ = kNull;
+        }
+        return std::make_pair(lhs, rhs);
+    }
+
+    static bool IsMarked(const Node& node) {
+        return node.subtree_flags_ & kPathMark;
+    }
+
+    // Cuts the rest of a multi-point split before the node and returns the root of the part
+    // from the node on, see split_at. The marked nodes run down the right spine of the rest
+    // from its root to the lowest one, marked. A climb from the right into that run leaves it
+    // as it is; a climb from the left, or from a marked node, takes the run below the node
+    // into the part
+    static uint32_t CutMarked(Pool& pool, uint32_t node, uint32_t* root, uint32_t* marked) {
+        CountRootWalk();
+        uint32_t lhs = pool[node].left_, rhs = kNull, lowest = kNull;
+        if (lhs) {
+            pool[lhs].parent_ = kNull;
+        }
+        pool[node].left_ = kNull;
+        uint32_t from = node, top = node;
+        if (!IsMarked(pool[node])) {
+            Update(pool, node);
+            rhs = node;
+            top = pool[node].parent_;
+            // As in SplitBefore, but the nodes going left stay marked for the next cuts
+            while (top && !IsMarked(pool[top])) {
+                uint32_t next = pool[top].parent_;
+                if (pool[top].right_ == from) {
+                    pool[top].right_ = lhs;
+                    if (lhs) {
+                        pool[lhs].parent_ = top;
+                    }
+                    pool[top].subtree_flags_ |= kPathMark;
+                    // Its update comes later, away from this climb: fetch the other child now
+                    if (pool[top].left_) {
+                        __builtin_prefetch(&pool[pool[top].left_]);
+                    }
+                    lowest = lowest ? lowest : top;
+                    lhs = top;
+                } else {
+                    pool[top].left_ = rhs;
+                    pool[rhs].parent_ = top;
+                    Update(pool, top);
+                    rhs = top;
+                }
+                from = top;
+                top = next;
+            }
+            if (top && pool[top].right_ == from) {
+                pool[top].right_ = lhs;
+                if (lhs) {
+                    pool[lhs].parent_ = top;
+                }
+                pool[rhs].parent_ = kNull;
+                *marked = lowest ? lowest : top;
+                return rhs;
+            }
         }
-        MakeRecursive(from->left_, begin, vmax, pbegin, pmax);
-        MakeRecursive(from->right_, ++vmax, end, ++pmax, pend);
-        if (from->left_) {
-            from->left_->parent_ = from;
-            from->child_count_ += from->left_->child_count_;
-            from->child_with_level_edges_count_ += from->left_->child_with_level_edges_count_;
-        }
-        if (from->right_) {
-            from->right_->parent_ = from;
-            from->child_count_ += from->right_->child_count_;
-            from->child_with_level_edges_count_ += from->right_->child_with_level_edges_count_;
-        }
-    }
-
-    static std::shared_ptr<Node> MergeRecursive(std::shared_ptr<Node> lhs,
-                                                std::shared_ptr<Node> rhs) {
-        if (!lhs) {
-            return rhs;
-        } else if (!rhs) {
-            return lhs;
-        } else if (lhs->priority_ < rhs->priority_) {
-            lhs->right_ = MergeRecursive(lhs->right_, rhs);
-            if (lhs->right_) {
-                lhs->right_->parent_ = lhs;
-                lhs->child_count_ += lhs->right_->child_count_;
-                lhs->child_with_level_edges_count_ += lhs->right_->child_with_level_edges_count_;
-            }
-            return lhs;
+        uint32_t up = kNull;
+        if (top) {
+            for (uint32_t below = *marked; below != top; below = pool[below].parent_) {
+                Update(pool, below);
+            }
+            pool[top].left_ = rhs;
+            if (rhs) {
+                pool[rhs].parent_ = top;
+            }
+            Update(pool, top);
+            up = pool[top].parent_;
+            rhs = top;
+        }
+        pool[rhs].parent_ = kNull;
+        if (up) {
+            pool[up].right_ = lhs;
         } else {
-            rhs->left_ = MergeRecursive(lhs, rhs->left_);
-            if (rhs->left_) {
-                rhs->left_->parent_ = rhs;
-                rhs->child_count_ += rhs->left_->child_count_;
-                rhs->child_with_level_edges_count_ += rhs->left_->child_with_level_edges_count_;
+            *root = lhs;
+        }
+        if (lhs) {
+            pool[lhs].parent_ = up;
+        }
+        *marked = lowest ? lowest : up;
+        return rhs;
+    }
+
+    static uint32_t Count(const Node& node, bool only_vertices) {
+        return only_vertices ? node.child_count_ : node.subtree_size_;
+    }
+    static uint32_t Weight(const Node& node, bool only_vertices) {
+        return only_vertices ? node.IsVertex() : 1;
+    }
+
+    static bool HasValidCounts(const Pool& pool, uint32_t from) {
+        const Node& node = pool[from];
+        uint32_t subtree_size = 1, child_count = node.IsVertex();
+        for (uint32_t child : {node.left_, node.right_}) {
+            if (child) {
+                subtree_size += pool[child].subtree_size_;
+                child_count += pool[child].child_count_;
             }
-            return rhs;
         }
+        return subtree_size == node.subtree_size_ && child_count == node.child_count_ &&
+               SubtreeFlags(pool, node) == node.subtree_flags_;
+    }
+
+    static void Update(Pool& pool, uint32_t from) {
+        Node& node = pool[from];
+        node.subtree_size_ = 1;
+        node.child_count_ = node.IsVertex();
+        node.subtree_flags_ = node.flags_ & kFlagBits;
+        if (node.left_) {
+            Add(node, pool[node.left_]);
+        }
+        if (node.right_) {
+            Add(node, pool[node.right_]);
+        }
+        UpdateAggregate(pool, from);
+    }
+
+    static void UpdateAggregate(Pool& pool, uint32_t from) {
+        if constexpr (kAggregated) {
+            Node& node = pool[from];
+            node.aggregate_ = node.payload_;
+            if (node.left_) {
+                Prepend(node, pool[node.left_]);
+            }
+            if (node.right_) {
+                Append(node, pool[node.right_]);
+            }
+        }
+    }
+
+    // Adds the counts of a subtree hung below the node
+    static void Add(Node& node, const Node& child) {
+        node.subtree_size_ += child.subtree_size_;
+        node.child_count_ += child.child_count_;
+        node.subtree_flags_ |= child.subtree_flags_;
+    }
+
+    // The flags of the node and of the subtrees below it
+    static uint8_t SubtreeFlags(const Pool& pool, const Node& node) {
+        uint8_t flags = node.flags_ & kFlagBits;
+        for (uint32_t child : {node.left_, node.right_}) {
+            if (child) {
+                flags |= pool[child].subtree_flags_;
+            }
+        }
+        return flags;
+    }
+
+    // Both extend the aggregate of the node by a subtree placed before (after) all of it
+    static void Prepend(Node& node, const Node& subtree) {
+        if constexpr (kAggregated) {
+            node.aggregate_ = Aggregate::Combine(subtree.aggregate_, node.aggregate_);
+        }
+    }
+    static void Append(Node& node, const Node& subtree) {
+        if constexpr (kAggregated) {
+            node.aggregate_ = Aggregate::Combine(node.aggregate_, subtree.aggregate_);
+        }
+    }
+
+    // Descends to the first node with the flag. The subtree must contain at least one
+    static uint32_t LeftmostFlagged(const Pool& pool, uint32_t from, size_t flag) {
+        while (true) {
+            uint32_t left = pool[from].left_;
+            if (left && pool[left].SubtreeHasFlag(flag)) {
+                from = left;
+            } else if (pool[from].HasFlag(flag)) {
+                return from;
+            } else {
+                from = pool[from].right_;
+            }
+        }
+    }
+
+    // The next node with the flag in the tree holding the node, or kNull. Each edge on the paths
+    // to flagged nodes is climbed once over a whole walk
+    static uint32_t NextFlagged(const Pool& pool, uint32_t node, size_t flag) {
+        uint32_t right = pool[node].right_;
+        if (right && pool[right].SubtreeHasFlag(flag)) {
+            return LeftmostFlagged(pool, right, flag);
+        }
+        for (uint32_t parent = pool[node].parent_; parent; parent = pool[node].parent_) {
+            if (pool[parent].left_ == node) {
+                if (pool[parent].HasFlag(flag)) {
+                    return parent;
+                }
+                right = pool[parent].right_;
+                if (right && pool[right].SubtreeHasFlag(flag)) {
+                    return LeftmostFlagged(pool, right, flag);
+                }
+            }
+            node = parent;
+        }
+        return kNull;
+    }
+
+    struct NoFlags {
+        bool operator*() const {
+            return false;
+        }
+        NoFlags& operator++() {
+            return *this;
+        }
+    };
+
+    // Builds the treap in one pass along its right spine, which parent links make a stack, so
+    // nothing is allocated. A node leaves the spine only when its subtree is complete, so counts
+    // are computed exactly once per node
+    template <class InitIterator, class FlagIterator, class NodeVisitor>
+    static uint32_t MakeLinear(Pool& pool, InitIterator begin, InitIterator end,
+                               FlagIterator is_vertex, NodeVisitor& on_node) {
+        // The lowest node of the spine; parent links lead up the rest of it
+        uint32_t spine = kNull;
+        for (InitIterator cur(begin); cur != end; ++cur, ++is_vertex) {
+            uint32_t node = pool.Allocate(*cur, PriorityGenerator::next());
+            pool[node].SetIsVertex(*is_vertex);
+            on_node(node);
+            uint32_t last = kNull;
+            while (spine && pool[spine].priority_ < pool[node].priority_) {
+                last = spine;
+                spine = pool[spine].parent_;
+                Update(pool, last);
+            }
+            pool[node].left_ = last;
+            if (last) {
+                pool[last].parent_ = node;
+            }
+            if (spine) {
+                pool[spine].right_ = node;
+                pool[node].parent_ = spine;
+            }
+            spine = node;
+        }
+        uint32_t root = kNull;
+        while (spine) {
+            root = spine;
+            spine = pool[spine].parent_;
+            Update(pool, root);
+        }
+        return root;
+    }
+
+    // Walks down the right spine of lhs and the left spine of rhs at once. A node taken from one
+    // side gets the whole rest of the other side below it, so its counts grow by that total
+    static uint32_t MergeIterative(Pool& pool, uint32_t lhs, uint32_t rhs) {
+        CountRootWalk();
+        uint32_t root = kNull, parent = kNull;
+        uint32_t* link = &root;
+        while (lhs && rhs) {
+            Node& left = pool[lhs];
+            Node& right = pool[rhs];
+            if (left.priority_ > right.priority_) {
+                Add(left, right);
+                Append(left, right);
+                left.parent_ = parent;
+                *link = parent = lhs;
+                link = &left.right_;
+                lhs = left.right_;
+            } else {
+                Add(right, left);
+                Prepend(right, left);
+                right.parent_ = parent;
+                *link = parent = rhs;
+                link = &right.left_;
+                rhs = right.left_;
+            }
+        }
+        uint32_t rest = lhs ? lhs : rhs;
+        *link = rest;
+        if (rest) {
+            pool[rest].parent_ = parent;
+        }
+        return root;
     }
 };
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Epoch-based reclamation for one writer and any number of readers. A reader pins the current
+// epoch while it holds pointers into shared memory. The writer retires memory it has unlinked,
+// and frees it once every reader that could have seen it is gone. Readers are counted in
+// stripes, so that they do not all contend for one cache line
+class EpochReclaimer {
+private:
+    struct alignas(64) Counter {
+        std::atomic<uint64_t> count_{0};
+    };
+
+public:
+    class Guard {
+    public:
+        Guard(const Guard&) = delete;
+        Guard& operator=(const Guard&) = delete;
+
+        ~Guard() {
+            counter_->count_.fetch_sub(1, std::memory_order_release);
+        }
+
+    private:
+        explicit Guard(Counter* counter) : counter_(counter) {
+        }
+
+        Counter* counter_;
+
+        friend class EpochReclaimer;
+    };
+
+    EpochReclaimer() = default;
+    EpochReclaimer(const EpochReclaimer&) = delete;
+    EpochReclaimer& operator=(const EpochReclaimer&) = delete;
+    ~EpochReclaimer() = default;
+
+    // Called by readers. Memory retired after this stays valid until the guard is destroyed
+    Guard Enter() const {
+        size_t stripe = Stripe();
+        while (true) {
+            uint64_t epoch = epoch_.load();
+            Counter* counter = &readers_[epoch & 1][stripe];
+            counter->count_.fetch_add(1);
+            // The writer may have moved on before the reader was counted
+            if (epoch_.load() == epoch) {
+                return Guard(counter);
+            }
+            counter->count_.fetch_sub(1, std::memory_order_release);
+        }
+    }
+
+    // Called by the writer once no new reader can reach the memory
+    void Retire(std::shared_ptr<const void> garbage) {
+        retired_[epoch_.load(std::memory_order_relaxed) & 1].emplace_back(std::move(garbage));
+    }
+
+    // Called by the writer. Frees what was retired two epochs ago and starts the next epoch,
+    // unless readers of the previous one are still active
+    void Collect() {
+        uint64_t epoch = epoch_.load(std::memory_order_relaxed);
+        size_t previous = (epoch + 1) & 1;
+        if (retired_[0].empty() && retired_[1].empty()) {
+            return;
+        }
+        // Orders the unlinking stores before the scan, so that a reader the scan misses entered
+        // late enough to see them
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        for (const Counter& counter : readers_[previous]) {
+            if (counter.count_.load(std::memory_order_acquire)) {
+                return;
+            }
+        }
+        retired_[previous].clear();
+        epoch_.store(epoch + 1);
+    }
+
+private:
+    static constexpr size_t kStripes = 16;
+
+    std::atomic<uint64_t> epoch_{0};
+    // Readers by the parity of the epoch they entered in
+    mutable Counter readers_[2][kStripes];
+    std::vector<std::shared_ptr<const void>> retired_[2];
+
+    static size_t Stripe() {
+        static std::atomic<size_t> n_threads(0);
+        thread_local size_t stripe = n_threads.fetch_add(1, std::memory_order_relaxed) % kStripes;
+        return stripe;
+    }
+};
@@ -0,0 +1,381 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "epoch_reclaimer.h"
+
+// Block arena for tree nodes. Nodes are addressed by 32-bit indices and never move, so indices
+// stay valid while the pool grows. Index 0 is reserved as the null link.
+//
+// Blocks are copy-on-write. A snapshot shares the whole pool in constant time, and the first
+// mutable access to a block after it copies just that block, while the snapshot keeps the old
+// one. Snapshots reach blocks through slabs of block pointers and a list of slabs, which are
+// copied on write the same way. Snapshots are taken by the writer and read from any thread.
+//
+// Live nodes can be read from other threads as well. The writer brackets changes in BeginWrite
+// and EndWrite, which bump a sequence number; ReadConsistent reruns a read until no write
+// overlapped it. Readers reach blocks through a directory, and blocks and directories replaced
+// by the writer are freed through epochs, so whatever a reader holds stays valid. Readers may
+// only load node fields that are RelaxedAtomic, everything else is the writer's alone.
+//
+// So far only CartesianBST supports this, for its parent links, and only over a pool that its
+// owner created for it, such as the one of a Forest. Default() is shared by every tree built
+// without a pool, from whatever thread, and nothing synchronises it
+template <class Node>
+class NodePool {
+public:
+    typedef Node value_type;
+
+    static constexpr uint32_t kNull = 0;
+    // Nodes copied at most by one mutable access after a snapshot. In a forest of 1e6 vertices
+    // blocks of 64 nodes slowed links and cuts down by 8-10% through the larger block table,
+    // blocks of 256 cost nothing measurable
+    static constexpr uint32_t kBlockSize = 256;
+
+private:
+    static constexpr uint32_t kBlockBits = 8;
+    static constexpr uint32_t kBlockMask = kBlockSize - 1;
+    static constexpr uint32_t kSlabBits = 4;
+    static constexpr uint32_t kSlabSize = 1u << kSlabBits;
+    static constexpr uint32_t kSlabMask = kSlabSize - 1;
+    static_assert(kBlockSize == 1u << kBlockBits, "Blocks are indexed by the low bits");
+
+    typedef std::shared_ptr<Node[]> Block;
+
+    struct Slab {
+        Block blocks_[kSlabSize];
+    };
+    typedef std::vector<std::shared_ptr<Slab>> Slabs;
+
+    struct Directory {
+        explicit Directory(size_t capacity)
+            : blocks_(new std::atomic<const Node*>[capacity]), capacity_(capacity) {
+            for (size_t i = 0; i < capacity; ++i) {
+                blocks_[i].store(nullptr, std::memory_order_relaxed);
+            }
+        }
+
+        std::unique_ptr<std::atomic<const Node*>[]> blocks_;
+        size_t capacity_;
+    };
+
+public:
+    // Frozen state of all nodes at the moment it was taken
+    class Snapshot {
+    public:
+        Snapshot() = default;
+
+        const Node& operator[](uint32_t index) const {
+            const Slab& slab = *(*slabs_)[index >> (kBlockBits + kSlabBits)];
+            return slab.blocks_[(index >> kBlockBits) & kSlabMask][index & kBlockMask];
+        }
+
+    private:
+        Snapshot(std::shared_ptr<const Slabs> slabs, std::shared_ptr<const void> alive)
+            : slabs_(std::move(slabs)), alive_(std::move(alive)) {
+        }
+
+        std::shared_ptr<const Slabs> slabs_;
+        std::shared_ptr<const void> alive_;
+
+        friend class NodePool;
+    };
+
+    // Nodes as a concurrent reader sees them. Reads may observe a write in progress, and then
+    // their result is dropped. Once a write is noticed every node reads as an empty one, so
+    // loops over links end
+    class ReadView {
+    public:
+        const Node& operator[](uint32_t index) const {
+            if (directory_ && pool_->sequence_.load(std::memory_order_acquire) != sequence_) {
+                directory_ = nullptr;
+            }
+            size_t block = index >> kBlockBits;
+            if (!directory_ || block >= directory_->capacity_) {
+                return Empty();
+            }
+            const Node* nodes = directory_->blocks_[block].load(std::memory_order_acquire);
+            return nodes ? nodes[index & kBlockMask] : Empty();
+        }
+
+    private:
+        ReadView(const NodePool* pool, uint64_t sequence)
+            : pool_(pool),
+              directory_(pool->published_.load(std::memory_order_acquire)),
+              sequence_(sequence) {
+        }
+
+        const NodePool* pool_;
+        mutable const Directory* directory_;
+        uint64_t sequence_;
+
+        static const Node& Empty() {
+            static const Node empty;
+            return empty;
+        }
+
+        friend class NodePool;
+    };
+
+    NodePool() : slabs_(std::make_shared<Slabs>()), alive_(std::make_shared<char>()), size_(1) {
+        AddBlock();
+    }
+
+    NodePool(const NodePool&) = delete;
+    NodePool& operator=(const NodePool&) = delete;
+
+    ~NodePool() = default;
+
+    template <class... Args>
+    uint32_t Allocate(Args&&... args) {
+        uint32_t index;
+        if (!free_list_.empty()) {
+            index = free_list_.back();
+            free_list_.pop_back();
+        } else {
+            if (size_ == std::numeric_limits<uint32_t>::max()) {
+                throw std::runtime_error("Node pool is exhausted");
+            }
+            index = size_++;
+            if ((index >> kBlockBits) == blocks_.size()) {
+                AddBlock();
+            }
+        }
+        (*this)[index] = Node(std::forward<Args>(args)...);
+        return index;
+    }
+
+    // Hands out count default nodes with consecutive indices, all in one block, and returns the
+    // first one. The rest of the block is skipped if they do not fit. Runs are never taken back,
+    // their owner keeps them for reuse
+    uint32_t AllocateRun(uint32_t count) {
+        if (count > kBlockSize) {
+            throw std::logic_error("Runs longer than a block are not supported");
+        }
+        uint32_t offset = size_ & kBlockMask;
+        uint64_t index = offset + count > kBlockSize ? size_ + kBlockSize - offset : size_;
+        if (index + count > std::numeric_limits<uint32_t>::max()) {
+            throw std::runtime_error("Node pool is exhausted");
+        }
+        size_ = index + count;
+        while ((index >> kBlockBits) >= blocks_.size()) {
+            AddBlock();
+        }
+        return index;
+    }
+
+    void Free(uint32_t index) {
+        free_list_.emplace_back(index);
+    }
+
+    // Checks one number while no snapshot is alive, and the block's generation while some are
+    Node& operator[](uint32_t index) {
+        uint32_t block = index >> kBlockBits;
+        if (generation_ && generations_[block] != generation_) {
+            Unshare(block);
+        }
+        return blocks_[block][index & kBlockMask];
+    }
+    const Node& operator[](uint32_t index) const {
+        return blocks_[index >> kBlockBits][index & kBlockMask];
+    }
+
+    // Number of nodes currently handed out
+    size_t Used() const {
+        return size_ - 1 - free_list_.size();
+    }
+
+    // Number of nodes copied so far because a snapshot held them
+    size_t Copied() const {
+        return n_copied_;
+    }
+
+    // Constant time, nothing is copied here. Afterwards the first mutable access to a block
+    // copies its kBlockSize nodes if a snapshot still holds it, and with it the slab of block
+    // pointers above it and, once per snapshot, the list of slabs. Once no snapshot is alive
+    // mutable access costs what it did before the first snapshot
+    Snapshot TakeSnapshot() {
+        generation_ = ++last_generation_;
+        return Snapshot(slabs_, alive_);
+    }
+
+    // Writer side; sections nest, and only the outermost one is seen by readers
+    void BeginWrite() {
+        if (!write_depth_++) {
+            sequence_.store(sequence_.load(std::memory_order_relaxed) + 1,
+                            std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+        }
+    }
+    void EndWrite() {
+        if (!--write_depth_) {
+            sequence_.store(sequence_.load(std::memory_order_relaxed) + 1,
+                            std::memory_order_release);
+            reclaimer_.Collect();
+        }
+    }
+
+    // Runs read(const ReadView&) from any thread until it overlaps no write, returns its result
+    template <class Read>
+    auto ReadConsistent(Read read) const {
+        auto guard = reclaimer_.Enter();
+        while (true) {
+            uint64_t sequence = sequence_.load(std::memory_order_acquire);
+            if (sequence & 1) {
+                std::this_thread::yield();
+                continue;
+            }
+            auto result = read(ReadView(this, sequence));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (sequence_.load(std::memory_order_relaxed) == sequence) {
+                return result;
+            }
+        }
+    }
+
+    // Pool of the trees built without one. Not for concurrent reads, see above
+    static NodePool& Default() {
+        static NodePool pool;
+        return pool;
+    }
+
+private:
+    // Nodes, and the generation of the snapshot after which the writer copied or checked each
+    // block; older blocks may be held by a snapshot
+    std::vector<Node*> blocks_;
+    std::vector<uint64_t> generations_;
+    // What snapshots hold. The list and every slab are shared with them until copied on write
+    std::shared_ptr<Slabs> slabs_;
+    // Held by every snapshot, so that the writer sees when none is left
+    std::shared_ptr<const void> alive_;
+    // Generation of the last snapshot, 0 while no snapshot is alive
+    uint64_t generation_ = 0;
+    uint64_t last_generation_ = 0;
+    size_t n_copied_ = 0;
+    std::vector<uint32_t> free_list_;
+    uint32_t size_;
+    // Odd while a write is in progress
+    std::atomic<uint64_t> sequence_{0};
+    uint32_t write_depth_ = 0;
+    std::shared_ptr<Directory> directory_;
+    std::atomic<const Directory*> published_{nullptr};
+    EpochReclaimer reclaimer_;
+
+    void AddBlock() {
+        uint32_t block = blocks_.size();
+        if (!directory_ || block == directory_->capacity_) {
+            auto directory = std::make_shared<Directory>(directory_ ? 2 * block : 1);
+            for (size_t i = 0; i < block; ++i) {
+                directory->blocks_[i].store(blocks_[i], std::memory_order_relaxed);
+            }
+            published_.store(directory.get(), std::memory_order_release);
+            if (directory_) {
+                reclaimer_.Retire(directory_);
+            }
+            directory_ = directory;
+        }
+        Block nodes(new Node[kBlockSize]);
+        directory_->blocks_[block].store(nodes.get(), std::memory_order_release);
+        blocks_.emplace_back(nodes.get());
+        generations_.emplace_back(generation_);
+        if (!(block & kSlabMask)) {
+            OwnSlabs().emplace_back(std::make_shared<Slab>());
+        }
+        OwnSlab(block >> kSlabBits).blocks_[block & kSlabMask] = std::move(nodes);
+    }
+
+    // Whether a snapshot may still read the object. If none can, pairs with the release of the
+    // last one that could, so that the writer may change it
+    template <class Object>
+    static bool IsShared(const std::shared_ptr<Object>& object) {
+        if (object.use_count() > 1) {
+            return true;
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return false;
+    }
+
+    // The list of slabs and a slab of it, copied first if a snapshot holds them
+    Slabs& OwnSlabs() {
+        if (IsShared(slabs_)) {
+            slabs_ = std::make_shared<Slabs>(*slabs_);
+        }
+        return *slabs_;
+    }
+    Slab& OwnSlab(uint32_t slab) {
+        std::shared_ptr<Slab>& pointer = OwnSlabs()[slab];
+        if (IsShared(pointer)) {
+            pointer = std::make_shared<Slab>(*pointer);
+        }
+        return *pointer;
+    }
+
+    // Out of line, so that the check in operator[] stays small where it is inlined
+    [[gnu::cold, gnu::noinline]] void Unshare(uint32_t block) {
+        if (!IsShared(alive_)) {
+            generation_ = 0;
+            return;
+        }
+        Block& nodes = OwnSlab(block >> kSlabBits).blocks_[block & kSlabMask];
+        if (IsShared(nodes)) {
+            Block copy(new Node[kBlockSize]);
+            std::copy(nodes.get(), nodes.get() + kBlockSize, copy.get());
+            n_copied_ += kBlockSize;
+            directory_->blocks_[block].store(copy.get(), std::memory_order_release);
+            reclaimer_.Retire(nodes);
+            nodes = std::move(copy);
+            blocks_[block] = nodes.get();
+        }
+        generations_[block] = generation_;
+    }
+};
+
+// A node field that concurrent readers load. Every access is a relaxed atomic one, which on
+// common hardware is as cheap as a plain one; ordering comes from the pool's sequence number
+template <class T>
+class RelaxedAtomic {
+public:
+    RelaxedAtomic(T value = T()) : value_(value) {
+    }
+    RelaxedAtomic(const RelaxedAtomic& other) : value_(T(other)) {
+    }
+    RelaxedAtomic& operator=(const RelaxedAtomic& other) {
+        return *this = T(other);
+    }
+    RelaxedAtomic& operator=(T value) {
+        value_.store(value, std::memory_order_relaxed);
+        return *this;
+    }
+
+    operator T() const {
+        return value_.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<T> value_;
+};
+
+// Brackets a write to a pool, or to anything else with BeginWrite and EndWrite
+template <class Pool>
+class WriteSection {
+public:
+    explicit WriteSection(Pool& pool) : pool_(pool) {
+        pool_.BeginWrite();
+    }
+    WriteSection(const WriteSection&) = delete;
+    WriteSection& operator=(const WriteSection&) = delete;
+    ~WriteSection() {
+        pool_.EndWrite();
+    }
+
+private:
+    Pool& pool_;
+};
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// Random priorities of treap nodes and heights of skip list towers. Every thread runs its own
+// splitmix64 generator, so concurrent construction does not contend. A new thread takes its seed
+// from a global counter, which makes runs reproducible as long as threads start in the same
+// order; seed() restarts the generator of the calling thread
+class PriorityGenerator {
+public:
+    // Never returns zero
+    static uint32_t next() {
+        uint64_t& state = State();
+        state += kGamma;
+        uint64_t mixed = state;
+        mixed = (mixed ^ (mixed >> 30)) * 0xbf58476d1ce4e5b9ull;
+        mixed = (mixed ^ (mixed >> 27)) * 0x94d049bb133111ebull;
+        uint32_t result = static_cast<uint32_t>((mixed ^ (mixed >> 31)) >> 32);
+        return result ? result : 1;
+    }
+
+    static void seed(uint64_t seed) {
+        State() = seed;
+    }
+
+private:
+    static constexpr uint64_t kGamma = 0x9e3779b97f4a7c15ull;
+    // Spreads the seeds of threads far apart along the sequence of the generator
+    static constexpr uint64_t kThreadStride = 0xd1b54a32d192ed03ull;
+
+    static uint64_t& State() {
+        static std::atomic<uint64_t> n_threads(0);
+        thread_local uint64_t state =
+            n_threads.fetch_add(1, std::memory_order_relaxed) * kThreadStride;
+        return state;
+    }
+};
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdexcept>
+#include <vector>
+
+// Multi-point split and multi-way merge of any sequence tree, as series of split() and merge()
+// calls. Splay, skip list and B-tree backends forward their split_at and merge_all here, so
+// these cost as much as the calls one by one; CartesianBST has one-pass versions of its own
+
+// Appends the trees to the tree; their handles must not be used afterwards
+template <class Tree, class TreeIterator>
+void MergeEach(Tree* tree, TreeIterator first, TreeIterator last) {
+    for (; first != last; ++first) {
+        tree->merge(*first);
+    }
+}
+
+// Cuts the tree holding the points before each of them and puts the k + 1 parts into parts.
+// Points are sorted nodes of one tree; repeated points and end() give empty parts. Parts are cut
+// off from the back, so every cut is in the part still holding the points before it.
+// tree_of(point) is the whole tree, for when nothing is cut. Reusing the vector of parts makes
+// repeated cuts allocate nothing
+template <class Tree, class TreeOf>
+void SplitEach(const std::vector<typename Tree::iterator>& points, std::vector<Tree>* parts,
+               TreeOf tree_of) {
+    if (points.empty()) {
+        throw std::logic_error("Nothing to split at");
+    }
+    typename Tree::Pool* pool = points.front().pool();
+    parts->assign(points.size() + 1, Tree(pool, Tree::Pool::kNull));
+    bool is_cut = false;
+    for (size_t i = points.size(); i-- > 0;) {
+        if (points[i].pool() != pool) {
+            throw std::logic_error("Cannot split trees from different pools");
+        }
+        if (points[i].is_end() || (i + 1 < points.size() && points[i] == points[i + 1])) {
+            continue;
+        }
+        auto tree_pair = points[i].split();
+        (*parts)[i + 1] = tree_pair.second;
+        (*parts)[0] = tree_pair.first;
+        is_cut = true;
+    }
+    if (!is_cut) {
+        (*parts)[0] = tree_of(points.front());
+    }
+}
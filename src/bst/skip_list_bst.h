@@ -0,0 +1,795 @@
+#pragma once
+
+#include <algorithm>
+#include <initializer_list>
+#include <memory>
+#include <stdexcept>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "node_pool.h"
+#include "priority_generator.h"
+#include "sequence_ops.h"
+#include "worker_threads.h"
+
+// Skip list over a sequence with the same interface as CartesianBST. Every sequence has a head
+// node taller than all of its nodes; level 0 is a cycle through the head, upper levels are
+// linear lists starting at it. A node keeps per level the counts of vertices and of nodes with
+// each flag from itself up to its successor on that level. get_root() returns the head. Nodes
+// carry Flags flags like in CartesianBST. The levels of a node sit next to each other in a pool
+// of their own.
+//
+// Unlike a treap, joins and splits only touch the towers next to the cut point, so batches of
+// them over different sequences run in parallel, see split_batch and merge_batch
+template <class T, size_t Flags = 1>
+class SkipListBST {
+    static_assert(Flags >= 1 && Flags <= 8, "Flags of a node are kept in one byte");
+
+private:
+    struct Level {
+        uint32_t prev_ = 0;
+        uint32_t next_ = 0;
+        uint32_t count_ = 0;
+        uint32_t flagged_counts_[Flags] = {};
+
+        // Adds the counts of a span that follows this one
+        void Absorb(const Level& other) {
+            count_ += other.count_;
+            for (size_t flag = 0; flag < Flags; ++flag) {
+                flagged_counts_[flag] += other.flagged_counts_[flag];
+            }
+        }
+    };
+
+    struct Node {
+        Node() = default;
+        explicit Node(const T& value) : value_(value) {
+        }
+
+        // First level of the tower, and how many levels it has room for
+        uint32_t tower_ = 0;
+        uint8_t height_ = 0;
+        uint8_t capacity_ = 0;
+        bool is_head_ = false;
+        bool is_vertex_ = false;
+        uint8_t flags_ = 0;
+        T value_ = T();
+
+        bool HasFlag(size_t flag) const {
+            return (flags_ >> flag) & 1;
+        }
+    };
+
+    static constexpr uint32_t kMaxHeight = 32;
+
+public:
+    typedef T value_type;
+
+    static constexpr size_t kFlags = Flags;
+
+    // Nodes, and their towers as runs of levels. Takes no snapshots, so no slab is ever shared
+    // and the copy-on-write check of a write only reads a zero count, which batch jobs on
+    // several threads may do at once
+    class Pool {
+    public:
+        static constexpr uint32_t kNull = 0;
+
+        Pool() = default;
+        // Runs large batches on the given threads instead of WorkerThreads::Default()
+        explicit Pool(WorkerThreads& workers) : workers_(&workers) {
+        }
+
+        Node& operator[](uint32_t index) {
+            return nodes_[index];
+        }
+        const Node& operator[](uint32_t index) const {
+            return nodes_[index];
+        }
+
+        // Number of nodes currently handed out
+        size_t Used() const {
+            return nodes_.Used();
+        }
+
+        void BeginWrite() {
+            nodes_.BeginWrite();
+            levels_.BeginWrite();
+        }
+        void EndWrite() {
+            levels_.EndWrite();
+            nodes_.EndWrite();
+        }
+
+        static Pool& Default() {
+            static Pool pool;
+            return pool;
+        }
+
+    private:
+        NodePool<Node> nodes_;
+        NodePool<Level> levels_;
+        // Released towers by capacity
+        std::vector<uint32_t> free_towers_[kMaxHeight + 1];
+        WorkerThreads* workers_ = nullptr;
+
+        WorkerThreads& Workers() const {
+            return workers_ ? *workers_ : WorkerThreads::Default();
+        }
+
+        friend class SkipListBST;
+    };
+
+private:
+    static constexpr uint32_t kNull = Pool::kNull;
+    // Batches with fewer operations are applied on the caller's thread
+    static constexpr size_t kParallelBatch = 1024;
+
+public:
+    class iterator {
+    public:
+        iterator() : pool_(nullptr), it_(kNull), is_end_(true) {
+        }
+        iterator(Pool* pool, uint32_t pointer, bool is_end = false)
+            : pool_(pool), it_(pointer), is_end_(is_end) {
+        }
+
+        iterator& operator++() {
+            if (is_end_) {
+                throw std::runtime_error("Index out of range while increasing");
+            }
+            it_ = Span(*pool_, it_, 0).next_;
+            is_end_ = (*pool_)[it_].is_head_;
+            return *this;
+        }
+        iterator operator++(int) {
+            iterator cpy(*this);
+            ++*this;
+            return cpy;
+        }
+        // Moves to the next node with the flag, skipping spans without it
+        iterator& next_flagged(size_t flag) {
+            if (is_end_) {
+                throw std::runtime_error("Index out of range while increasing");
+            }
+            uint32_t found = NextFlagged(*pool_, it_, flag);
+            if (found) {
+                it_ = found;
+            } else {
+                it_ = FindHead(*pool_, it_);
+                is_end_ = true;
+            }
+            return *this;
+        }
+        iterator& next_with_level_edges() {
+            return next_flagged(0);
+        }
+        iterator& operator--() {
+            if (!it_) {
+                throw std::runtime_error("Index out of range while decreasing");
+            }
+            uint32_t prev = Span(*pool_, it_, 0).prev_;
+            if ((*pool_)[prev].is_head_) {
+                throw std::runtime_error("Index out of range while decreasing");
+            }
+            it_ = prev;
+            is_end_ = false;
+            return *this;
+        }
+        iterator operator--(int) {
+            iterator cpy(*this);
+            --*this;
+            return cpy;
+        }
+
+        const T operator*() const {
+            if (is_end_) {
+                throw std::runtime_error("Index out of range in operator*");
+            }
+            return (*pool_)[it_].value_;
+        }
+        const T* operator->() const {
+            if (is_end_) {
+                throw std::runtime_error("Index out of range in operator->");
+            }
+            return &(*pool_)[it_].value_;
+        }
+
+        bool operator==(const iterator& other) const {
+            return it_ == other.it_ && is_end_ == other.is_end_ && pool_ == other.pool_;
+        }
+        bool operator!=(const iterator& other) const {
+            return !(*this == other);
+        }
+
+        iterator get_root() const {
+            if (!it_) {
+                return *this;
+            }
+            return iterator(pool_, FindHead(*pool_, it_));
+        }
+
+        std::pair<SkipListBST, SkipListBST> split() const {
+            if (is_end_) {
+                throw std::logic_error("Cannot split in empty parts");
+            }
+            Pool& pool = *pool_;
+            uint32_t prev = Span(pool, it_, 0).prev_;
+            if (pool[prev].is_head_) {
+                return std::make_pair(SkipListBST(pool_, kNull), SkipListBST(pool_, prev));
+            }
+            uint32_t new_head = NewNode(pool, T(), 0);
+            pool[new_head].is_head_ = true;
+            uint32_t head = Cut(pool, it_, new_head);
+            return std::make_pair(SkipListBST(pool_, head), SkipListBST(pool_, new_head));
+        }
+
+        void set_flag(size_t flag, bool value) const {
+            Node& node = (*pool_)[it_];
+            if (node.HasFlag(flag) != value) {
+                node.flags_ ^= 1u << flag;
+                AddToOwners(*pool_, it_, 0, flag, value ? 1 : -1);
+            }
+        }
+
+        bool has_flag(size_t flag) const {
+            return (*pool_)[it_].HasFlag(flag);
+        }
+
+        void set_has_level_edges(bool has_level_edges) const {
+            set_flag(0, has_level_edges);
+        }
+
+        bool has_level_edges() const {
+            return has_flag(0);
+        }
+
+        void set_is_vertex(bool is_vertex) const {
+            Node& node = (*pool_)[it_];
+            if (node.is_vertex_ != is_vertex) {
+                node.is_vertex_ = is_vertex;
+                AddToOwners(*pool_, it_, is_vertex ? 1 : -1);
+            }
+        }
+
+        Pool* pool() const {
+            return pool_;
+        }
+        uint32_t index() const {
+            return it_;
+        }
+        bool is_end() const {
+            return is_end_;
+        }
+
+    private:
+        Pool* pool_;
+        uint32_t it_;
+        bool is_end_;
+    };
+
+    SkipListBST() = delete;
+
+    // Takes the head of a sequence, as returned by get_root(), or kNull for an empty one
+    SkipListBST(Pool* pool, uint32_t head) : pool_(pool), head_(head) {
+    }
+
+    template <class InitIterator>
+    SkipListBST(InitIterator begin, InitIterator end, Pool& pool = Pool::Default())
+        : SkipListBST(begin, end, NoFlags(), pool) {
+    }
+
+    // Marks the nodes for which the flags sequence is true as vertices. Linear time
+    template <class InitIterator, class FlagIterator>
+    SkipListBST(InitIterator begin, InitIterator end, FlagIterator is_vertex, Pool& pool)
+        : SkipListBST(begin, end, is_vertex, pool, [](uint32_t) {}) {
+    }
+    // Also passes the node of every value to on_node, in order
+    template <class InitIterator, class FlagIterator, class NodeVisitor>
+    SkipListBST(InitIterator begin, InitIterator end, FlagIterator is_vertex, Pool& pool,
+                NodeVisitor on_node)
+        : pool_(&pool), head_(kNull) {
+        std::vector<uint32_t> nodes;
+        uint32_t height = 1;
+        for (InitIterator cur(begin); cur != end; ++cur, ++is_vertex) {
+            nodes.emplace_back(NewNode(pool, *cur, RandomHeight()));
+            Node& node = pool[nodes.back()];
+            node.is_vertex_ = *is_vertex;
+            height = std::max<uint32_t>(height, node.height_ + 1);
+            on_node(nodes.back());
+        }
+        if (nodes.empty()) {
+            return;
+        }
+        head_ = NewNode(pool, T(), height);
+        pool[head_].is_head_ = true;
+        std::vector<uint32_t> last(height, head_);
+        for (uint32_t node : nodes) {
+            uint32_t node_height = Height(pool, node);
+            uint32_t count = pool[node].is_vertex_;
+            for (uint32_t level = 0; level < height; ++level) {
+                if (level < node_height) {
+                    Span(pool, last[level], level).next_ = node;
+                    Span(pool, node, level).prev_ = last[level];
+                    Span(pool, node, level).count_ = count;
+                    last[level] = node;
+                } else {
+                    Span(pool, last[level], level).count_ += count;
+                }
+            }
+        }
+        Span(pool, last[0], 0).next_ = head_;
+        Span(pool, head_, 0).prev_ = last[0];
+    }
+
+    SkipListBST(const SkipListBST& other) = default;
+    SkipListBST& operator=(const SkipListBST& other) = default;
+
+    ~SkipListBST() = default;
+
+    iterator begin(bool with_level_edges = false) const {
+        if (empty()) {
+            return end();
+        }
+        if (with_level_edges) {
+            return begin_flagged(0);
+        }
+        return iterator(pool_, Span(*pool_, head_, 0).next_);
+    }
+    // The first node with the flag, or end()
+    iterator begin_flagged(size_t flag) const {
+        if (empty() || !Top(*pool_, head_).flagged_counts_[flag]) {
+            return end();
+        }
+        return iterator(pool_, NextFlagged(*pool_, head_, flag));
+    }
+    iterator end() const {
+        return iterator(pool_, head_, true);
+    }
+
+    // What get_root() of any of its nodes returns, without walking up to it
+    iterator get_root() const {
+        return iterator(pool_, head_);
+    }
+
+    // Appends the other tree. The other handle must not be used afterwards
+    void merge(SkipListBST other) {
+        if (other.empty()) {
+            return;
+        }
+        if (empty()) {
+            *this = other;
+            return;
+        }
+        if (pool_ != other.pool_) {
+            throw std::logic_error("Cannot merge trees from different pools");
+        }
+        Join(*pool_, head_, other.head_);
+        FreeNode(*pool_, other.head_);
+    }
+
+    // Appends all the trees, see MergeEach
+    void merge_all(const std::vector<SkipListBST>& others) {
+        MergeEach(this, others.begin(), others.end());
+    }
+    // The same for a braced list of trees, which needs no vector
+    void merge_all(std::initializer_list<SkipListBST> others) {
+        MergeEach(this, others.begin(), others.end());
+    }
+
+    // Cuts the tree holding the points before each of them, see SplitEach. Batches over many
+    // sequences are split_batch
+    static void split_at(const std::vector<iterator>& points, std::vector<SkipListBST>* parts) {
+        SplitEach(points, parts, [](const iterator& point) {
+            return SkipListBST(point.pool(), point.get_root().index());
+        });
+    }
+
+    // Calls the visitor with the value of every node with the flag, in order. Each search skips
+    // the spans without the flag, see CartesianBST::for_each_flagged. The visitor must not change
+    // the tree
+    template <class Visitor>
+    void for_each_flagged(size_t flag, Visitor visitor) const {
+        if (empty() || !Top(*pool_, head_).flagged_counts_[flag]) {
+            return;
+        }
+        const Pool& pool = *pool_;
+        for (uint32_t node = NextFlagged(pool, head_, flag); node;
+             node = NextFlagged(pool, node, flag)) {
+            visitor(pool[node].value_);
+        }
+    }
+
+    // Appends the values of the nodes with the flag to out
+    void collect_flagged(size_t flag, std::vector<T>* out) const {
+        for_each_flagged(flag, [out](const T& value) { out->push_back(value); });
+    }
+
+    // Releases every node of the tree. Iterators into it become invalid
+    void clear() {
+        if (empty()) {
+            return;
+        }
+        Pool& pool = *pool_;
+        uint32_t cur = head_;
+        do {
+            uint32_t next = Span(pool, cur, 0).next_;
+            FreeNode(pool, cur);
+            cur = next;
+        } while (cur != head_);
+        head_ = kNull;
+    }
+
+    bool empty() const {
+        return !head_;
+    }
+
+    size_t size() const {
+        return empty() ? 0 : Top(*pool_, head_).count_;
+    }
+
+    // Cuts the sequences before every given node, as a series of split() calls would. The parts
+    // are reached through SkipListBST(it.pool(), it.get_root().index()). Cuts in different
+    // sequences are applied in parallel, cuts within a sequence one after another
+    static void split_batch(const std::vector<iterator>& cuts) {
+        if (cuts.empty()) {
+            return;
+        }
+        Pool& pool = *cuts.front().pool();
+        for (const auto& cut : cuts) {
+            if (cut.is_end() || cut.pool() != &pool) {
+                throw std::logic_error("Cannot split in empty parts");
+            }
+        }
+        std::vector<uint32_t> heads(cuts.size());
+        RunParallel(pool, cuts.size(), cuts.size(), [&](size_t i) {
+            heads[i] = FindHead(pool, cuts[i].index());
+        });
+        auto groups = GroupBy(heads);
+        // A new head grows as tall as the head it is cut from, which never grows in a split
+        std::vector<uint32_t> new_heads(cuts.size());
+        for (size_t i = 0; i < cuts.size(); ++i) {
+            new_heads[i] = NewNode(pool, T(), 0);
+            pool[new_heads[i]].is_head_ = true;
+            Reserve(pool, new_heads[i], Height(pool, heads[i]));
+        }
+        std::vector<char> used(cuts.size(), false);
+        RunParallel(pool, cuts.size(), groups.size(), [&](size_t group) {
+            for (size_t i : groups[group]) {
+                uint32_t node = cuts[i].index();
+                if (!pool[Span(pool, node, 0).prev_].is_head_) {
+                    Cut(pool, node, new_heads[i]);
+                    used[i] = true;
+                }
+            }
+        });
+        for (size_t i = 0; i < cuts.size(); ++i) {
+            if (!used[i]) {
+                FreeNode(pool, new_heads[i]);
+            }
+        }
+    }
+
+    // Appends the sequence starting at the second node of every pair to the one ending at the
+    // first, as a series of merge() calls would. Chains are allowed, cycles are not. Independent
+    // chains are joined in parallel
+    static void merge_batch(const std::vector<std::pair<iterator, iterator>>& links) {
+        if (links.empty()) {
+            return;
+        }
+        Pool& pool = *links.front().first.pool();
+        std::unordered_set<uint32_t> lasts, firsts;
+        for (const auto& link : links) {
+            uint32_t last = link.first.index(), first = link.second.index();
+            if (link.first.is_end() || link.second.is_end() || link.first.pool() != &pool ||
+                link.second.pool() != &pool ||
+                !pool[Span(pool, last, 0).next_].is_head_ ||
+                !pool[Span(pool, first, 0).prev_].is_head_ || !lasts.insert(last).second ||
+                !firsts.insert(first).second) {
+                throw std::logic_error("Links must join the end of a sequence to a start");
+            }
+        }
+        std::vector<uint32_t> heads(2 * links.size());
+        RunParallel(pool, links.size(), heads.size(), [&](size_t i) {
+            const auto& link = links[i / 2];
+            heads[i] = FindHead(pool, i % 2 ? link.second.index() : link.first.index());
+        });
+        // Chains of joined sequences by a disjoint set union over the heads
+        std::unordered_map<uint32_t, uint32_t> parents;
+        auto find = [&parents](uint32_t head) {
+            auto it = parents.find(head);
+            while (it != parents.end() && it->second != head) {
+                head = it->second;
+                it = parents.find(head);
+            }
+            return head;
+        };
+        std::vector<uint32_t> chains(links.size());
+        for (size_t i = 0; i < links.size(); ++i) {
+            uint32_t lhs = find(heads[2 * i]), rhs = find(heads[2 * i + 1]);
+            if (lhs == rhs) {
+                throw std::logic_error("Links must not close a cycle");
+            }
+            parents[lhs] = lhs;
+            parents[rhs] = lhs;
+        }
+        for (size_t i = 0; i < links.size(); ++i) {
+            chains[i] = find(heads[2 * i]);
+        }
+        auto groups = GroupBy(chains);
+        // Every head of a chain may end up holding all of it, so grows as tall as the tallest
+        for (const auto& group : groups) {
+            uint32_t height = 0;
+            for (size_t i : group) {
+                height = std::max(
+                    {height, Height(pool, heads[2 * i]), Height(pool, heads[2 * i + 1])});
+            }
+            for (size_t i : group) {
+                Reserve(pool, heads[2 * i], height);
+                Reserve(pool, heads[2 * i + 1], height);
+            }
+        }
+        std::vector<uint32_t> freed(links.size());
+        RunParallel(pool, links.size(), groups.size(), [&](size_t group) {
+            for (size_t i : groups[group]) {
+                uint32_t lhs = FindHead(pool, links[i].first.index());
+                freed[i] = FindHead(pool, links[i].second.index());
+                Join(pool, lhs, freed[i]);
+            }
+        });
+        for (uint32_t head : freed) {
+            FreeNode(pool, head);
+        }
+    }
+
+private:
+    Pool* pool_;
+    uint32_t head_;
+
+    /* ---------------------------------------------------
+     * ------------------STATIC METHODS-------------------
+     * ---------------------------------------------------
+     */
+
+    struct NoFlags {
+        bool operator*() const {
+            return false;
+        }
+        NoFlags& operator++() {
+            return *this;
+        }
+    };
+
+    static uint32_t RandomHeight() {
+        uint32_t random = PriorityGenerator::next(), height = 1;
+        while ((random & 1) && height + 1 < kMaxHeight) {
+            random >>= 1;
+            ++height;
+        }
+        return height;
+    }
+
+    static uint32_t Height(const Pool& pool, uint32_t node) {
+        return pool[node].height_;
+    }
+
+    static const Level& Span(const Pool& pool, uint32_t node, uint32_t level) {
+        return pool.levels_[pool[node].tower_ + level];
+    }
+    static Level& Span(Pool& pool, uint32_t node, uint32_t level) {
+        return pool.levels_[pool[node].tower_ + level];
+    }
+
+    // The level that spans the whole sequence, for a head
+    static const Level& Top(const Pool& pool, uint32_t node) {
+        return Span(pool, node, Height(pool, node) - 1);
+    }
+
+    static uint32_t NewNode(Pool& pool, const T& value, uint32_t height) {
+        uint32_t node = pool.nodes_.Allocate(value);
+        Reserve(pool, node, height);
+        pool[node].height_ = height;
+        return node;
+    }
+
+    static void FreeNode(Pool& pool, uint32_t node) {
+        if (pool[node].capacity_) {
+            pool.free_towers_[pool[node].capacity_].emplace_back(pool[node].tower_);
+        }
+        pool.nodes_.Free(node);
+    }
+
+    // Makes room in the tower for the given height, so that growing it up to there allocates
+    // nothing. Parallel batches grow heads only within what was reserved. Heads grow a level at
+    // a time, so their room is doubled
+    static void Reserve(Pool& pool, uint32_t node, uint32_t height) {
+        uint32_t capacity = pool[node].capacity_;
+        if (height <= capacity) {
+            return;
+        }
+        capacity = std::min(std::max(height, 2 * capacity), kMaxHeight);
+        uint32_t tower;
+        if (pool.free_towers_[capacity].empty()) {
+            tower = pool.levels_.AllocateRun(capacity);
+        } else {
+            tower = pool.free_towers_[capacity].back();
+            pool.free_towers_[capacity].pop_back();
+        }
+        for (uint32_t level = 0; level < capacity; ++level) {
+            pool.levels_[tower + level] =
+                level < Height(pool, node) ? Span(pool, node, level) : Level();
+        }
+        if (pool[node].capacity_) {
+            pool.free_towers_[pool[node].capacity_].emplace_back(pool[node].tower_);
+        }
+        pool[node].tower_ = tower;
+        pool[node].capacity_ = capacity;
+    }
+
+    // Adds an empty level on top of the tower
+    static Level& Grow(Pool& pool, uint32_t node) {
+        uint32_t height = Height(pool, node);
+        if (height == pool[node].capacity_) {
+            Reserve(pool, node, height + 1);
+        }
+        ++pool[node].height_;
+        return Span(pool, node, height) = Level();
+    }
+
+    static uint32_t FindHead(const Pool& pool, uint32_t node) {
+        uint32_t level = 0;
+        while (!pool[node].is_head_) {
+            if (Height(pool, node) > level + 1) {
+                ++level;
+            } else {
+                node = Span(pool, node, level).prev_;
+            }
+        }
+        return node;
+    }
+
+    // Adds to the counts of every level whose span covers the node
+    static void AddToOwners(Pool& pool, uint32_t node, int count, size_t flag = 0,
+                            int flagged_count = 0) {
+        for (uint32_t level = 0;; ++level) {
+            while (Height(pool, node) <= level) {
+                node = Span(pool, node, level - 1).prev_;
+            }
+            Span(pool, node, level).count_ += count;
+            Span(pool, node, level).flagged_counts_[flag] += flagged_count;
+            if (pool[node].is_head_ && level + 1 == Height(pool, node)) {
+                return;
+            }
+        }
+    }
+
+    // First node with the flag after the given one, kNull if there is none. From the head it is
+    // the first one of the sequence
+    static uint32_t NextFlagged(const Pool& pool, uint32_t node, size_t flag) {
+        uint32_t level = 0;
+        node = Span(pool, node, 0).next_;
+        while (node && !pool[node].is_head_ && !Span(pool, node, level).flagged_counts_[flag]) {
+            if (Height(pool, node) > level + 1) {
+                ++level;
+            } else {
+                node = Span(pool, node, level).next_;
+            }
+        }
+        if (!node || pool[node].is_head_) {
+            return kNull;
+        }
+        while (level > 0) {
+            --level;
+            while (!Span(pool, node, level).flagged_counts_[flag]) {
+                node = Span(pool, node, level).next_;
+            }
+        }
+        return node;
+    }
+
+    // Cuts the sequence before the node, which must not be its first one. The right part is
+    // hung on new_head, the head of the left part is returned
+    static uint32_t Cut(Pool& pool, uint32_t node, uint32_t new_head) {
+        uint32_t owner = Span(pool, node, 0).prev_;
+        // Counts between the owner of a level and the cut point
+        Level counts = Span(pool, owner, 0);
+        for (uint32_t level = 0;; ++level) {
+            Level& span = Span(pool, owner, level);
+            Level& new_span = Grow(pool, new_head);
+            new_span.count_ = span.count_ - counts.count_;
+            span.count_ = counts.count_;
+            for (size_t flag = 0; flag < Flags; ++flag) {
+                new_span.flagged_counts_[flag] =
+                    span.flagged_counts_[flag] - counts.flagged_counts_[flag];
+                span.flagged_counts_[flag] = counts.flagged_counts_[flag];
+            }
+            if (level > 0) {
+                new_span.next_ = span.next_;
+                if (span.next_) {
+                    Span(pool, span.next_, level).prev_ = new_head;
+                }
+                span.next_ = kNull;
+            }
+            if (pool[owner].is_head_ && level + 1 == Height(pool, owner)) {
+                break;
+            }
+            while (Height(pool, owner) <= level + 1) {
+                owner = Span(pool, owner, level).prev_;
+                counts.Absorb(Span(pool, owner, level));
+            }
+        }
+        uint32_t head = owner, left = Span(pool, node, 0).prev_;
+        uint32_t last = Span(pool, head, 0).prev_;
+        Span(pool, left, 0).next_ = head;
+        Span(pool, head, 0).prev_ = left;
+        Span(pool, last, 0).next_ = new_head;
+        Span(pool, new_head, 0).prev_ = last;
+        Span(pool, new_head, 0).next_ = node;
+        Span(pool, node, 0).prev_ = new_head;
+        return head;
+    }
+
+    // Appends the sequence of rhs_head to the one of lhs_head. rhs_head is left detached
+    static void Join(Pool& pool, uint32_t lhs_head, uint32_t rhs_head) {
+        Level lhs_total = Top(pool, lhs_head);
+        Level rhs_total = Top(pool, rhs_head);
+        lhs_total.prev_ = lhs_total.next_ = kNull;
+        uint32_t rhs_height = Height(pool, rhs_head);
+        while (Height(pool, lhs_head) < rhs_height) {
+            Grow(pool, lhs_head) = lhs_total;
+        }
+        uint32_t owner = Span(pool, lhs_head, 0).prev_;
+        uint32_t first = Span(pool, rhs_head, 0).next_;
+        uint32_t last = Span(pool, rhs_head, 0).prev_;
+        for (uint32_t level = 0;; ++level) {
+            while (Height(pool, owner) <= level) {
+                owner = Span(pool, owner, level - 1).prev_;
+            }
+            Level& span = Span(pool, owner, level);
+            const Level& rhs_span = level < rhs_height ? Span(pool, rhs_head, level) : rhs_total;
+            span.Absorb(rhs_span);
+            if (level > 0 && level < rhs_height) {
+                span.next_ = rhs_span.next_;
+                if (rhs_span.next_) {
+                    Span(pool, rhs_span.next_, level).prev_ = owner;
+                }
+            }
+            if (owner == lhs_head && level + 1 == Height(pool, owner)) {
+                break;
+            }
+        }
+        uint32_t lhs_last = Span(pool, lhs_head, 0).prev_;
+        Span(pool, lhs_last, 0).next_ = first;
+        Span(pool, first, 0).prev_ = lhs_last;
+        Span(pool, last, 0).next_ = lhs_head;
+        Span(pool, lhs_head, 0).prev_ = last;
+    }
+
+    // Indices of equal keys, grouped together
+    static std::vector<std::vector<size_t>> GroupBy(const std::vector<uint32_t>& keys) {
+        std::unordered_map<uint32_t, size_t> group_of;
+        std::vector<std::vector<size_t>> groups;
+        for (size_t i = 0; i < keys.size(); ++i) {
+            auto it = group_of.emplace(keys[i], groups.size()).first;
+            if (it->second == groups.size()) {
+                groups.emplace_back();
+            }
+            groups[it->second].emplace_back(i);
+        }
+        return groups;
+    }
+
+    // Calls job(i) for every i below n_jobs, spreading them over the worker threads of the pool
+    // when the batch is large. Jobs write to nodes and must not allocate
+    template <class Job>
+    static void RunParallel(const Pool& pool, size_t batch_size, size_t n_jobs, const Job& job) {
+        if (batch_size < kParallelBatch || n_jobs < 2 || pool.Workers().Size() < 2) {
+            for (size_t i = 0; i < n_jobs; ++i) {
+                job(i);
+            }
+            return;
+        }
+        pool.Workers().Run(n_jobs, job);
+    }
+};
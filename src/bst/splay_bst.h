@@ -0,0 +1,606 @@
+#pragma once
+
+#include <initializer_list>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include "node_pool.h"
+#include "sequence_ops.h"
+
+// Splay tree over an implicit key with the same interface as CartesianBST. Every operation that
+// walks a path splays its end, so repeated work on the same parts of a sequence gets cheap.
+// The shape changes on every access, so trees are identified by their first node: get_root()
+// returns it rather than the current root. Nodes carry Flags flags like in CartesianBST
+template <class T, size_t Flags = 1>
+class SplayBST {
+    static_assert(Flags >= 1 && Flags <= 8, "Flags of a node are kept in one byte");
+
+private:
+    struct Node {
+        Node() = default;
+        explicit Node(const T& value) : value_(value) {
+        }
+
+        uint32_t left_ = 0;
+        uint32_t right_ = 0;
+        uint32_t parent_ = 0;
+        uint32_t subtree_size_ = 1;
+        uint32_t child_count_ = 0;
+        uint32_t flagged_counts_[Flags] = {};
+        bool is_vertex_ = false;
+        uint8_t flags_ = 0;
+        T value_ = T();
+
+        bool HasFlag(size_t flag) const {
+            return (flags_ >> flag) & 1;
+        }
+    };
+
+public:
+    typedef T value_type;
+    typedef NodePool<Node> Pool;
+
+    static constexpr size_t kFlags = Flags;
+
+private:
+    static constexpr uint32_t kNull = Pool::kNull;
+
+public:
+    class iterator {
+    public:
+        iterator() : pool_(nullptr), it_(kNull), is_end_(true) {
+        }
+        iterator(Pool* pool, uint32_t pointer, bool is_end = false)
+            : pool_(pool), it_(pointer), is_end_(is_end) {
+        }
+
+        iterator& operator++() {
+            if (is_end_) {
+                throw std::runtime_error("Index out of range while increasing");
+            }
+            Pool& pool = *pool_;
+            if (pool[it_].right_) {
+                it_ = pool[it_].right_;
+                while (pool[it_].left_) {
+                    it_ = pool[it_].left_;
+                }
+            } else {
+                uint32_t parent = pool[it_].parent_, start = it_;
+                while (parent && pool[parent].right_ == it_) {
+                    it_ = parent;
+                    parent = pool[it_].parent_;
+                }
+                if (parent) {
+                    it_ = parent;
+                } else {
+                    it_ = start;
+                    is_end_ = true;
+                }
+            }
+            return *this;
+        }
+        iterator operator++(int) {
+            iterator cpy(*this);
+            ++*this;
+            return cpy;
+        }
+        // Moves to the next node with the flag, skipping unflagged subtrees
+        iterator& next_flagged(size_t flag) {
+            if (is_end_) {
+                throw std::runtime_error("Index out of range while increasing");
+            }
+            Pool& pool = *pool_;
+            Splay(pool, it_);
+            uint32_t right = pool[it_].right_;
+            if (right && pool[right].flagged_counts_[flag]) {
+                it_ = LeftmostFlagged(pool, right, flag);
+                Splay(pool, it_);
+                return *this;
+            }
+            // Nothing flagged after the node, so the end is the rightmost one
+            while (pool[it_].right_) {
+                it_ = pool[it_].right_;
+            }
+            Splay(pool, it_);
+            is_end_ = true;
+            return *this;
+        }
+        iterator& next_with_level_edges() {
+            return next_flagged(0);
+        }
+        iterator& operator--() {
+            if (is_end_) {
+                if (!it_) {
+                    throw std::runtime_error("Index out of range while decreasing");
+                }
+                is_end_ = false;
+                return *this;
+            }
+            Pool& pool = *pool_;
+            if (pool[it_].left_) {
+                it_ = pool[it_].left_;
+                while (pool[it_].right_) {
+                    it_ = pool[it_].right_;
+                }
+            } else {
+                uint32_t parent = pool[it_].parent_;
+                while (parent && pool[parent].left_ == it_) {
+                    it_ = parent;
+                    parent = pool[it_].parent_;
+                }
+                if (parent) {
+                    it_ = parent;
+                } else {
+                    throw std::runtime_error("Index out of range while decreasing");
+                }
+            }
+            return *this;
+        }
+        iterator operator--(int) {
+            iterator cpy(*this);
+            --*this;
+            return cpy;
+        }
+
+        const T operator*() const {
+            if (is_end_) {
+                throw std::runtime_error("Index out of range in operator*");
+            }
+            return (*pool_)[it_].value_;
+        }
+        const T* operator->() const {
+            if (is_end_) {
+                throw std::runtime_error("Index out of range in operator->");
+            }
+            return &(*pool_)[it_].value_;
+        }
+
+        bool operator==(const iterator& other) const {
+            return it_ == other.it_ && is_end_ == other.is_end_ && pool_ == other.pool_;
+        }
+        bool operator!=(const iterator& other) const {
+            return !(*this == other);
+        }
+
+        iterator get_root() const {
+            Pool& pool = *pool_;
+            Splay(pool, it_);
+            return iterator(pool_, SplayLeftmost(pool, it_));
+        }
+
+        std::pair<SplayBST, SplayBST> split() const {
+            if (is_end_) {
+                throw std::logic_error("Cannot split in empty parts");
+            }
+            Pool& pool = *pool_;
+            Splay(pool, it_);
+            uint32_t lhs = pool[it_].left_;
+            if (lhs) {
+                pool[lhs].parent_ = kNull;
+                pool[it_].left_ = kNull;
+                Update(pool, it_);
+            }
+            return std::make_pair(SplayBST(pool_, lhs), SplayBST(pool_, it_));
+        }
+
+        void set_flag(size_t flag, bool value) const {
+            Pool& pool = *pool_;
+            Splay(pool, it_);
+            pool[it_].flags_ &= ~(1u << flag);
+            pool[it_].flags_ |= static_cast<unsigned>(value) << flag;
+            Update(pool, it_);
+        }
+
+        bool has_flag(size_t flag) const {
+            return (*pool_)[it_].HasFlag(flag);
+        }
+
+        void set_has_level_edges(bool has_level_edges) const {
+            set_flag(0, has_level_edges);
+        }
+
+        bool has_level_edges() const {
+            return has_flag(0);
+        }
+
+        void set_is_vertex(bool is_vertex) const {
+            Pool& pool = *pool_;
+            Splay(pool, it_);
+            pool[it_].is_vertex_ = is_vertex;
+            Update(pool, it_);
+        }
+
+        Pool* pool() const {
+            return pool_;
+        }
+        uint32_t index() const {
+            return it_;
+        }
+        bool is_end() const {
+            return is_end_;
+        }
+
+    private:
+        Pool* pool_;
+        uint32_t it_;
+        bool is_end_;
+    };
+
+    SplayBST() = delete;
+
+    // Takes any node of a tree
+    SplayBST(Pool* pool, uint32_t node) : pool_(pool) {
+        if (!node) {
+            begin_ = end_ = kNull;
+            return;
+        }
+        Splay(*pool_, node);
+        end_ = SplayRightmost(*pool_, node);
+        begin_ = SplayLeftmost(*pool_, end_);
+    }
+
+    template <class InitIterator>
+    SplayBST(InitIterator begin, InitIterator end, Pool& pool = Pool::Default())
+        : SplayBST(begin, end, NoFlags(), pool) {
+    }
+
+    // Marks the nodes for which the flags sequence is true as vertices
+    template <class InitIterator, class FlagIterator>
+    SplayBST(InitIterator begin, InitIterator end, FlagIterator is_vertex, Pool& pool)
+        : SplayBST(begin, end, is_vertex, pool, [](uint32_t) {}) {
+    }
+    // Also passes the node of every value to on_node, in order
+    template <class InitIterator, class FlagIterator, class NodeVisitor>
+    SplayBST(InitIterator begin, InitIterator end, FlagIterator is_vertex, Pool& pool,
+             NodeVisitor on_node)
+        : pool_(&pool), begin_(kNull), end_(kNull) {
+        std::vector<uint32_t> nodes;
+        for (InitIterator cur(begin); cur != end; ++cur, ++is_vertex) {
+            nodes.emplace_back(pool.Allocate(*cur));
+            pool[nodes.back()].is_vertex_ = *is_vertex;
+            on_node(nodes.back());
+        }
+        if (!nodes.empty()) {
+            MakeBalanced(pool, nodes, 0, nodes.size());
+            begin_ = nodes.front();
+            end_ = nodes.back();
+        }
+    }
+
+    SplayBST(const SplayBST& other) = default;
+    SplayBST& operator=(const SplayBST& other) = default;
+
+    ~SplayBST() = default;
+
+    iterator begin(bool with_level_edges = false) const {
+        if (!begin_) {
+            return iterator(pool_, end_, true);
+        }
+        return with_level_edges ? begin_flagged(0) : iterator(pool_, begin_);
+    }
+    // The first node with the flag, or end()
+    iterator begin_flagged(size_t flag) const {
+        if (!begin_) {
+            return iterator(pool_, end_, true);
+        }
+        iterator it(pool_, begin_);
+        if (!it.has_flag(flag)) {
+            it.next_flagged(flag);
+        }
+        return it;
+    }
+    iterator end() const {
+        return iterator(pool_, end_, true);
+    }
+
+    // What get_root() of any of its nodes returns, without walking up to it
+    iterator get_root() const {
+        return iterator(pool_, begin_);
+    }
+
+    // Appends the other tree. The other handle must not be used afterwards
+    void merge(SplayBST other) {
+        if (other.empty()) {
+            return;
+        }
+        if (empty()) {
+            *this = other;
+            return;
+        }
+        if (pool_ != other.pool_) {
+            throw std::logic_error("Cannot merge trees from different pools");
+        }
+        Pool& pool = *pool_;
+        Splay(pool, end_);
+        Splay(pool, other.begin_);
+        pool[end_].right_ = other.begin_;
+        pool[other.begin_].parent_ = end_;
+        Update(pool, end_);
+        end_ = other.end_;
+    }
+
+    // Appends all the trees, see MergeEach
+    void merge_all(const std::vector<SplayBST>& others) {
+        MergeEach(this, others.begin(), others.end());
+    }
+    // The same for a braced list of trees, which needs no vector
+    void merge_all(std::initializer_list<SplayBST> others) {
+        MergeEach(this, others.begin(), others.end());
+    }
+
+    // Cuts the tree holding the points before each of them, see SplitEach. Every split splays
+    // its point to the root anyway
+    static void split_at(const std::vector<iterator>& points, std::vector<SplayBST>* parts) {
+        SplitEach(points, parts,
+                  [](const iterator& point) { return SplayBST(point.pool(), point.index()); });
+    }
+
+    // Calls the visitor with the value of every node with the flag, in order, see
+    // CartesianBST::for_each_flagged. The walk does not splay, so it leaves the shape as it is
+    template <class Visitor>
+    void for_each_flagged(size_t flag, Visitor visitor) const {
+        if (empty()) {
+            return;
+        }
+        Pool& pool = *pool_;
+        uint32_t root = Root();
+        if (!pool[root].flagged_counts_[flag]) {
+            return;
+        }
+        for (uint32_t node = LeftmostFlagged(pool, root, flag); node;
+             node = NextFlagged(pool, node, flag)) {
+            visitor(pool[node].value_);
+        }
+    }
+
+    // Appends the values of the nodes with the flag to out
+    void collect_flagged(size_t flag, std::vector<T>* out) const {
+        for_each_flagged(flag, [out](const T& value) { out->push_back(value); });
+    }
+
+    // Releases every node of the tree. Iterators into it become invalid
+    void clear() {
+        Pool& pool = *pool_;
+        uint32_t cur = empty() ? kNull : Root();
+        while (cur) {
+            Node& node = pool[cur];
+            if (node.left_) {
+                cur = node.left_;
+                node.left_ = kNull;
+            } else if (node.right_) {
+                cur = node.right_;
+                node.right_ = kNull;
+            } else {
+                uint32_t parent = node.parent_;
+                pool.Free(cur);
+                cur = parent;
+            }
+        }
+        begin_ = end_ = kNull;
+    }
+
+    bool empty() const {
+        return !begin_;
+    }
+
+    size_t size() const {
+        return empty() ? 0 : (*pool_)[Root()].child_count_;
+    }
+
+    // Number of nodes before the iterator, or of vertices only. The end iterator gets the total
+    size_t index_of(const iterator& it, bool only_vertices = false) const {
+        uint32_t node = it.index();
+        if (!node) {
+            return 0;
+        }
+        Pool& pool = *it.pool();
+        Splay(pool, node);
+        size_t index = it.is_end() ? Weight(pool[node], only_vertices) : 0;
+        if (pool[node].left_) {
+            index += Count(pool[pool[node].left_], only_vertices);
+        }
+        return index;
+    }
+
+    // The k-th node counting from zero, or the k-th vertex. Returns end() if there are fewer
+    iterator kth(size_t k, bool only_vertices = false) const {
+        if (empty()) {
+            return end();
+        }
+        Pool& pool = *pool_;
+        uint32_t node = Root();
+        if (k >= Count(pool[node], only_vertices)) {
+            return end();
+        }
+        while (true) {
+            uint32_t left = pool[node].left_;
+            size_t left_count = left ? Count(pool[left], only_vertices) : 0;
+            if (k < left_count) {
+                node = left;
+                continue;
+            }
+            k -= left_count;
+            size_t weight = Weight(pool[node], only_vertices);
+            if (k < weight) {
+                Splay(pool, node);
+                return iterator(pool_, node);
+            }
+            k -= weight;
+            node = pool[node].right_;
+        }
+    }
+
+private:
+    Pool* pool_;
+    uint32_t begin_;
+    uint32_t end_;
+
+    uint32_t Root() const {
+        Splay(*pool_, begin_);
+        return begin_;
+    }
+
+    /* ---------------------------------------------------
+     * ------------------STATIC METHODS-------------------
+     * ---------------------------------------------------
+     */
+
+    struct NoFlags {
+        bool operator*() const {
+            return false;
+        }
+        NoFlags& operator++() {
+            return *this;
+        }
+    };
+
+    static uint32_t Count(const Node& node, bool only_vertices) {
+        return only_vertices ? node.child_count_ : node.subtree_size_;
+    }
+    static uint32_t Weight(const Node& node, bool only_vertices) {
+        return only_vertices ? node.is_vertex_ : 1;
+    }
+
+    static void Update(Pool& pool, uint32_t from) {
+        Node& node = pool[from];
+        node.subtree_size_ = 1;
+        node.child_count_ = node.is_vertex_;
+        for (size_t flag = 0; flag < Flags; ++flag) {
+            node.flagged_counts_[flag] = node.HasFlag(flag);
+        }
+        if (node.left_) {
+            Add(node, pool[node.left_]);
+        }
+        if (node.right_) {
+            Add(node, pool[node.right_]);
+        }
+    }
+
+    // Adds the counts of a subtree hung below the node
+    static void Add(Node& node, const Node& child) {
+        node.subtree_size_ += child.subtree_size_;
+        node.child_count_ += child.child_count_;
+        for (size_t flag = 0; flag < Flags; ++flag) {
+            node.flagged_counts_[flag] += child.flagged_counts_[flag];
+        }
+    }
+
+    // Lifts the node over its parent. Each node is looked up once, as every mutable lookup
+    // checks whether its block is shared with a snapshot
+    static void Rotate(Pool& pool, uint32_t node) {
+        Node& lifted = pool[node];
+        uint32_t parent = lifted.parent_;
+        Node& lowered = pool[parent];
+        uint32_t grandparent = lowered.parent_;
+        uint32_t middle;
+        if (lowered.left_ == node) {
+            middle = lifted.right_;
+            lowered.left_ = middle;
+            lifted.right_ = parent;
+        } else {
+            middle = lifted.left_;
+            lowered.right_ = middle;
+            lifted.left_ = parent;
+        }
+        if (middle) {
+            pool[middle].parent_ = parent;
+        }
+        lowered.parent_ = node;
+        lifted.parent_ = grandparent;
+        if (grandparent) {
+            Node& above = pool[grandparent];
+            if (above.left_ == parent) {
+                above.left_ = node;
+            } else {
+                above.right_ = node;
+            }
+        }
+        Update(pool, parent);
+        Update(pool, node);
+    }
+
+    static void Splay(Pool& pool, uint32_t node) {
+        while (uint32_t parent = pool[node].parent_) {
+            uint32_t grandparent = pool[parent].parent_;
+            if (grandparent) {
+                bool zig_zig = (pool[grandparent].left_ == parent) == (pool[parent].left_ == node);
+                Rotate(pool, zig_zig ? parent : node);
+            }
+            Rotate(pool, node);
+        }
+    }
+
+    // Both take the root of a tree and make its first (last) node the new root
+    static uint32_t SplayLeftmost(Pool& pool, uint32_t from) {
+        while (pool[from].left_) {
+            from = pool[from].left_;
+        }
+        Splay(pool, from);
+        return from;
+    }
+    static uint32_t SplayRightmost(Pool& pool, uint32_t from) {
+        while (pool[from].right_) {
+            from = pool[from].right_;
+        }
+        Splay(pool, from);
+        return from;
+    }
+
+    // Descends to the first node with the flag. The subtree must contain at least one
+    static uint32_t LeftmostFlagged(Pool& pool, uint32_t from, size_t flag) {
+        while (true) {
+            uint32_t left = pool[from].left_;
+            if (left && pool[left].flagged_counts_[flag]) {
+                from = left;
+            } else if (pool[from].HasFlag(flag)) {
+                return from;
+            } else {
+                from = pool[from].right_;
+            }
+        }
+    }
+
+    // The next node with the flag in the tree holding the node, or kNull. Does not splay
+    static uint32_t NextFlagged(Pool& pool, uint32_t node, size_t flag) {
+        uint32_t right = pool[node].right_;
+        if (right && pool[right].flagged_counts_[flag]) {
+            return LeftmostFlagged(pool, right, flag);
+        }
+        for (uint32_t parent = pool[node].parent_; parent; parent = pool[node].parent_) {
+            if (pool[parent].left_ == node) {
+                if (pool[parent].HasFlag(flag)) {
+                    return parent;
+                }
+                right = pool[parent].right_;
+                if (right && pool[right].flagged_counts_[flag]) {
+                    return LeftmostFlagged(pool, right, flag);
+                }
+            }
+            node = parent;
+        }
+        return kNull;
+    }
+
+    static uint32_t MakeBalanced(Pool& pool, const std::vector<uint32_t>& nodes, size_t begin,
+                                 size_t end) {
+        if (begin == end) {
+            return kNull;
+        }
+        size_t mid = begin + (end - begin) / 2;
+        uint32_t from = nodes[mid];
+        uint32_t left = MakeBalanced(pool, nodes, begin, mid);
+        uint32_t right = MakeBalanced(pool, nodes, mid + 1, end);
+        pool[from].left_ = left;
+        pool[from].right_ = right;
+        if (left) {
+            pool[left].parent_ = from;
+        }
+        if (right) {
+            pool[right].parent_ = from;
+        }
+        Update(pool, from);
+        return from;
+    }
+};
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Threads started once and kept for running batches of jobs, so that a batch does not pay for
+// starting them. Batches run one at a time, whichever thread submits them
+class WorkerThreads {
+public:
+    explicit WorkerThreads(size_t n_threads) : n_threads_(n_threads) {
+        for (size_t thread = 0; thread < n_threads_; ++thread) {
+            threads_.emplace_back([this, thread]() { Work(thread); });
+        }
+    }
+
+    WorkerThreads(const WorkerThreads&) = delete;
+    WorkerThreads& operator=(const WorkerThreads&) = delete;
+
+    ~WorkerThreads() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        started_.notify_all();
+        for (auto& thread : threads_) {
+            thread.join();
+        }
+    }
+
+    size_t Size() const {
+        return n_threads_;
+    }
+
+    // Calls job(i) for every i below n_jobs and returns once all calls are done. Job i runs on
+    // thread i % Size(), so jobs with close indices go to different threads. The job is not
+    // copied, so a batch allocates nothing
+    template <class Job>
+    void Run(size_t n_jobs, const Job& job) {
+        std::lock_guard<std::mutex> batch_lock(batch_mutex_);
+        std::unique_lock<std::mutex> lock(mutex_);
+        call_ = [](const void* context, size_t i) { (*static_cast<const Job*>(context))(i); };
+        context_ = &job;
+        n_jobs_ = n_jobs;
+        running_ = n_threads_;
+        ++batch_;
+        started_.notify_all();
+        finished_.wait(lock, [this]() { return !running_; });
+        call_ = nullptr;
+        context_ = nullptr;
+    }
+
+    // A thread per core, started on first use
+    static WorkerThreads& Default() {
+        static WorkerThreads workers(std::max(1u, std::thread::hardware_concurrency()));
+        return workers;
+    }
+
+private:
+    const size_t n_threads_;
+    std::vector<std::thread> threads_;
+    // Taken for a whole batch
+    std::mutex batch_mutex_;
+    std::mutex mutex_;
+    std::condition_variable started_;
+    std::condition_variable finished_;
+    // The job of the current batch, called through a plain function with the job as context
+    void (*call_)(const void*, size_t) = nullptr;
+    const void* context_ = nullptr;
+    size_t n_jobs_ = 0;
+    size_t running_ = 0;
+    uint64_t batch_ = 0;
+    bool stopping_ = false;
+
+    void Work(size_t thread) {
+        uint64_t done = 0;
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            started_.wait(lock, [this, done]() { return stopping_ || batch_ != done; });
+            if (stopping_) {
+                return;
+            }
+            done = batch_;
+            auto call = call_;
+            const void* context = context_;
+            size_t n_jobs = n_jobs_;
+            lock.unlock();
+            for (size_t i = thread; i < n_jobs; i += n_threads_) {
+                call(context, i);
+            }
+            lock.lock();
+            if (!--running_) {
+                finished_.notify_one();
+            }
+        }
+    }
+};
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+// Open-addressing table from undirected edges to small values. Keys pack both ends into 64 bits,
+// slots are probed linearly, and erasing shifts the following entries back instead of leaving
+// tombstones, so lookups stop at the first empty slot. Loops are not edges, which frees key 0 to
+// mark empty slots
+template <class Value>
+class EdgeTable {
+public:
+    static constexpr size_t kNotFound = static_cast<size_t>(-1);
+
+    EdgeTable() : EdgeTable(0) {
+    }
+    // Holds this many edges without growing
+    explicit EdgeTable(size_t capacity) {
+        size_t n_slots = kMinSlots;
+        while (n_slots < 2 * capacity) {
+            n_slots <<= 1;
+        }
+        Reset(n_slots);
+    }
+
+    static uint64_t Key(size_t u, size_t v) {
+        if (u > v) {
+            std::swap(u, v);
+        }
+        if (v > UINT32_MAX) {
+            throw std::runtime_error("Vertex ids do not fit into edge keys");
+        }
+        return (static_cast<uint64_t>(u) << 32) | v;
+    }
+
+    // Slot of the edge, or kNotFound
+    size_t Find(uint64_t key) const {
+        for (size_t slot = Home(key);; slot = (slot + 1) & mask_) {
+            if (slots_[slot].key_ == key) {
+                return slot;
+            }
+            if (slots_[slot].key_ == kEmpty) {
+                return kNotFound;
+            }
+        }
+    }
+
+    Value& At(size_t slot) {
+        return slots_[slot].value_;
+    }
+
+    // Replaces the value if the edge is already there
+    void Insert(uint64_t key, const Value& value) {
+        if (2 * (size_ + 1) > slots_.size()) {
+            Grow();
+        }
+        size_t slot = Home(key);
+        while (slots_[slot].key_ != kEmpty && slots_[slot].key_ != key) {
+            slot = (slot + 1) & mask_;
+        }
+        size_ += slots_[slot].key_ == kEmpty;
+        slots_[slot] = {key, value};
+    }
+
+    // Erases the entry found by Find without probing for it again
+    void EraseAt(size_t slot) {
+        size_t hole = slot;
+        for (size_t next = (hole + 1) & mask_; slots_[next].key_ != kEmpty;
+             next = (next + 1) & mask_) {
+            // An entry may fill the hole unless that would put it before its home slot
+            size_t home = Home(slots_[next].key_);
+            if (((next - home) & mask_) >= ((next - hole) & mask_)) {
+                slots_[hole] = slots_[next];
+                hole = next;
+            }
+        }
+        slots_[hole].key_ = kEmpty;
+        --size_;
+    }
+
+    size_t size() const {
+        return size_;
+    }
+
+private:
+    static constexpr uint64_t kEmpty = 0;
+    static constexpr size_t kMinSlots = 8;
+
+    struct Slot {
+        uint64_t key_ = kEmpty;
+        Value value_ = Value();
+    };
+
+    std::vector<Slot> slots_;
+    size_t mask_;
+    int shift_;
+    size_t size_ = 0;
+
+    // Fibonacci hashing: the top bits of the product depend on every bit of the key
+    size_t Home(uint64_t key) const {
+        return (key * 0x9e3779b97f4a7c15ull) >> shift_;
+    }
+
+    void Reset(size_t n_slots) {
+        slots_.assign(n_slots, Slot());
+        mask_ = n_slots - 1;
+        shift_ = 64;
+        while (n_slots > 1) {
+            n_slots >>= 1;
+            --shift_;
+        }
+        size_ = 0;
+    }
+
+    void Grow() {
+        std::vector<Slot> old;
+        old.swap(slots_);
+        Reset(2 * old.size());
+        for (const Slot& slot : old) {
+            if (slot.key_ != kEmpty) {
+                Insert(slot.key_, slot.value_);
+            }
+        }
+    }
+};
@@ -1,45 +1,87 @@
-#include <unordered_map>
+#include <memory>
+#include <unordered_set>
+#include <vector>
 
-#include "../../src/bst/bst_interface.h"
+#include "../../src/bst/b_tree_bst.h"
 #include "../../src/bst/cartesian_bst.h"
+#include "../../src/bst/skip_list_bst.h"
+#include "../../src/bst/splay_bst.h"
+#include "edge_table.h"
 
+template <class BST>
 class LevelGraph;
 
+// Euler-tour forest over a sequence tree. BST is statically dispatched: it provides the
+// operations of CartesianBST, its node Pool and a constructor from a pool and a null root.
+// CartesianBST, SplayBST, SkipListBST and BTreeBST are available. Pool indices are 32-bit, so
+// 32-bit vertex values lose nothing and keep treap nodes small
+template <class BST = CartesianBST<uint32_t>>
 class Forest {
 public:
-    class EdgeHash {
+    typedef BST Tree;
+    typedef typename BST::iterator iterator;
+    typedef typename BST::Pool Pool;
+
+private:
+    struct CachedRoot {
+        uint64_t epoch_ = 0;
+        uint32_t root_ = 0;
+    };
+
+    // Nodes of both traversals of an edge, in the direction it was added in
+    struct EdgeNodes {
+        uint32_t straight_;
+        uint32_t back_;
+    };
+
+public:
+    // Frozen connectivity of a forest. Snapshots are taken by the writer and can be queried from
+    // other threads while the forest keeps changing. Needs a BST with find_root over pool
+    // snapshots, such as CartesianBST
+    class Snapshot {
     public:
-        size_t operator()(const std::pair<size_t, size_t>& pair) const noexcept {
-            return pair.first ^
-                   (pair.second + 0x9e3779b9 + (pair.first << 6ul) + (pair.first >> 2ul));
+        bool is_connected(size_t u, size_t v) const {
+            if (u == v) {
+                throw std::runtime_error("Loop is not a valid edge");
+            }
+            if (u >= n_vertices_ || v >= n_vertices_) {
+                throw std::runtime_error("No such vertices in graph");
+            }
+            return BST::find_root(nodes_, (*vertex_nodes_)[u]) ==
+                   BST::find_root(nodes_, (*vertex_nodes_)[v]);
         }
-    };
 
-private:
-    struct EdgeIterators {
-        EdgeIterators() = default;
-        EdgeIterators(const IBST<size_t>::iterator& straight, const IBST<size_t>::iterator& back)
-            : straight_(straight), back_(back) {
+    private:
+        Snapshot(typename Pool::Snapshot nodes,
+                 std::shared_ptr<const std::vector<uint32_t>> vertex_nodes, size_t n_vertices)
+            : nodes_(std::move(nodes)), vertex_nodes_(vertex_nodes), n_vertices_(n_vertices) {
         }
 
-        IBST<size_t>::iterator straight_;
-        IBST<size_t>::iterator back_;
+        typename Pool::Snapshot nodes_;
+        std::shared_ptr<const std::vector<uint32_t>> vertex_nodes_;
+        size_t n_vertices_;
+
+        friend class Forest;
     };
 
-public:
     Forest() = delete;
+    Forest(const Forest&) = delete;
+    Forest& operator=(const Forest&) = delete;
     ~Forest() = default;
 
-    explicit Forest(size_t n_vertices) : n_vertices_(n_vertices) {
-        for (size_t i = 0; i < n_vertices_; ++i) {
-            std::vector<size_t> tour({i});
-            auto tree = std::make_shared<CartesianBST<size_t>>(tour.begin(), tour.end());
-            vertices_[i] = tree->begin();
-            tree->begin().set_is_vertex(true);
-            last_vertices_keeper_[i] = tree->begin();
-        }
+    explicit Forest(size_t n_vertices) : Forest(n_vertices, {}) {
+    }
+
+    // Builds a forest from its edges in O(n): every tour is laid out by a depth-first search in
+    // the order that linking would leave it in, and its tree is built over the sequence at once.
+    // Throws if the edges contain a cycle
+    Forest(size_t n_vertices, const std::vector<std::pair<size_t, size_t>>& edges)
+        : edges_(n_vertices), roots_(n_vertices), n_vertices_(n_vertices) {
+        Build(edges);
     }
 
+    // A tour holds one node per vertex and one node per traversal of a tree edge. The node of
+    // a traversal keeps the vertex it leads to
     void add_new_edge(size_t u, size_t v) {
         if (u == v) {
             throw std::runtime_error("Loop is not a valid edge");
@@ -47,64 +89,61 @@ public:
         if (u >= n_vertices_ || v >= n_vertices_) {
             throw std::runtime_error("No such vertices in graph");
         }
-        auto first_pair = vertices_[u].split();
-        std::vector<size_t> add_vertex({u});
-        auto add_tree =
-            std::make_shared<CartesianBST<size_t>>(add_vertex.begin(), add_vertex.end());
-        auto edge_iterator = add_tree->begin();
-        vertices_[u].set_is_vertex(false);
-        vertices_[u] = edge_iterator;
-        vertices_[u].set_is_vertex(true);
-        first_pair.first->merge(add_tree);
-
-        auto second_pair = vertices_[v].split();
-        add_vertex = {v};
-        add_tree = std::make_shared<CartesianBST<size_t>>(add_vertex.begin(), add_vertex.end());
-        auto back_edge_iterator = add_tree->begin();
-        second_pair.first->merge(add_tree);
-
-        auto iterator_to_remove = --second_pair.second->end();
-        last_vertices_keeper_.erase(*iterator_to_remove);
-        auto v_delta_pair = iterator_to_remove.split();
-        if (v_delta_pair.first->empty()) {
-            vertices_[v].set_is_vertex(false);
-            vertices_[v] = back_edge_iterator;
-            vertices_[v].set_is_vertex(true);
-        }
-
-        first_pair.first->merge(v_delta_pair.first);
-        second_pair.first->merge(first_pair.second);
-        first_pair.first->merge(second_pair.first);
-        edges_[std::make_pair(u, v)] = EdgeIterators(edge_iterator, back_edge_iterator);
-    }
-
-    std::pair<std::shared_ptr<IBST<size_t>>, std::shared_ptr<IBST<size_t>>> erase_existing_edge(
-        size_t u, size_t v) {
+        WriteSection<Pool> section(pool_);
+        ++epoch_;
+        auto edge_tree = MakeOccurrence(v);
+        auto edge_iterator = edge_tree.begin();
+        auto back_tree = MakeOccurrence(u);
+        auto back_edge_iterator = back_tree.begin();
+        // Tours are cyclic, so the tour of u needs no rerooting: the tour of v, rotated to start
+        // at v and wrapped into the two traversals of the edge, goes right before the vertex
+        // node of u. That is one split per tour, each a climb from its vertex node that no
+        // cached root can spare, and one pass over the six pieces
+        auto u_parts = Vertex(u).split();
+        auto v_parts = Vertex(v).split();
+        u_parts.first.merge_all(
+            {edge_tree, v_parts.second, v_parts.first, back_tree, u_parts.second});
+        edges_.Insert(EdgeTable<EdgeNodes>::Key(u, v),
+                      {edge_iterator.index(), back_edge_iterator.index()});
+    }
+
+    // Rotates the tour of v to start at its vertex node: one split and one merge
+    void reroot(size_t v) {
+        if (v >= n_vertices_) {
+            throw std::runtime_error("No such vertices in graph");
+        }
+        Reroot(v);
+    }
+
+    std::pair<BST, BST> erase_existing_edge(size_t u, size_t v) {
         if (u == v) {
             throw std::runtime_error("Loop is not a valid edge");
         }
         if (u >= n_vertices_ || v >= n_vertices_) {
             throw std::runtime_error("No such vertices in graph");
         }
-        if (edges_.find(std::make_pair(u, v)) == edges_.end()) {
-            std::swap(u, v);
-        }
-        auto edge = std::make_pair(u, v);
-        if (edges_.find(edge) == edges_.end()) {
+        size_t slot = edges_.Find(EdgeTable<EdgeNodes>::Key(u, v));
+        if (slot == EdgeTable<EdgeNodes>::kNotFound) {
             throw std::runtime_error("No such edge in graph");
         }
-        auto edge_iterators = edges_[edge];
-        edges_.erase(edge);
-        auto first_split = edge_iterators.straight_.split();
-        auto second_split = (++edge_iterators.back_).split();
-        vertices_[u].set_is_vertex(false);
-        vertices_[u] = second_split.second->begin();
-        vertices_[u].set_is_vertex(true);
-        first_split.first->merge(second_split.second);
-
-        auto mid_part = (++first_split.second->begin()).split();
-        last_vertices_keeper_[v] = --second_split.first->end();
-        return std::make_pair(first_split.first, mid_part.second);
+        WriteSection<Pool> section(pool_);
+        iterator straight(&pool_, edges_.At(slot).straight_);
+        iterator back(&pool_, edges_.At(slot).back_);
+        edges_.EraseAt(slot);
+        ++epoch_;
+        // The tour is cyclic: the part of one end lies between straight and back, possibly
+        // wrapping around the end of the sequence. The root of the part before straight comes
+        // with its handle, so only back walks up to its root
+        auto first_split = Detach(straight);
+        bool back_is_first =
+            !first_split.first.empty() && back.get_root() == first_split.first.get_root();
+        auto second_split = Detach(back);
+        if (back_is_first) {
+            first_split.second.merge(second_split.first);
+            return std::make_pair(second_split.second, first_split.second);
+        }
+        first_split.first.merge(second_split.second);
+        return std::make_pair(first_split.first, second_split.first);
     }
 
     bool is_connected(size_t u, size_t v) {
@@ -114,14 +153,223 @@ public:
         if (u >= n_vertices_ || v >= n_vertices_) {
             throw std::runtime_error("No such vertices in graph");
         }
-        return vertices_[u].get_root() == vertices_[v].get_root();
+        return Root(u) == Root(v);
+    }
+
+    // Safe from any thread while another one links and cuts: sees the forest between two
+    // updates, never in the middle of one. Needs a BST with find_root, such as CartesianBST
+    bool concurrent_is_connected(size_t u, size_t v) const {
+        if (u == v) {
+            throw std::runtime_error("Loop is not a valid edge");
+        }
+        if (u >= n_vertices_ || v >= n_vertices_) {
+            throw std::runtime_error("No such vertices in graph");
+        }
+        uint32_t u_node = (*vertex_nodes_)[u], v_node = (*vertex_nodes_)[v];
+        return pool_.ReadConsistent([u_node, v_node](const typename Pool::ReadView& nodes) {
+            return BST::find_root(nodes, u_node) == BST::find_root(nodes, v_node);
+        });
+    }
+
+    // Payloads sit on vertex nodes, so with an aggregating BST such as
+    // CartesianBST<uint32_t, 1, SumAggregate<W>> every component sums them up in its root
+    template <class Payload>
+    void set_payload(size_t v, const Payload& payload) {
+        if (v >= n_vertices_) {
+            throw std::runtime_error("No such vertices in graph");
+        }
+        Vertex(v).set_payload(payload);
+    }
+
+    auto component_aggregate(size_t v) {
+        if (v >= n_vertices_) {
+            throw std::runtime_error("No such vertices in graph");
+        }
+        return Vertex(v).tree_aggregate();
+    }
+
+    // Shapes of all tours together, O(n). Needs a BST with shape(), such as CartesianBST
+    auto shape() {
+        typename BST::Shape shape;
+        std::unordered_set<uint32_t> roots;
+        for (size_t v = 0; v < n_vertices_; ++v) {
+            uint32_t root = Root(v);
+            if (roots.insert(root).second) {
+                shape.merge(BST(&pool_, root).shape());
+            }
+        }
+        return shape;
+    }
+
+    // Average depth of vertex nodes of evenly spaced vertices, O(samples log n)
+    double sample_depth(size_t n_samples) {
+        n_samples = std::min(n_samples, n_vertices_);
+        if (!n_samples) {
+            return 0;
+        }
+        size_t total = 0;
+        for (size_t i = 0; i < n_samples; ++i) {
+            total += Vertex(i * n_vertices_ / n_samples).depth();
+        }
+        return static_cast<double>(total) / n_samples;
+    }
+
+    // Constant time; later writes copy each block of nodes the snapshot holds once, see
+    // NodePool::TakeSnapshot
+    Snapshot snapshot() {
+        return Snapshot(pool_.TakeSnapshot(), vertex_nodes_, n_vertices_);
     }
 
 private:
-    std::unordered_map<size_t, IBST<size_t>::iterator> vertices_;
-    std::unordered_map<std::pair<size_t, size_t>, EdgeIterators, EdgeHash> edges_;
-    std::unordered_map<size_t, IBST<size_t>::iterator> last_vertices_keeper_;
+    Pool pool_;
+    // A forest has fewer edges than vertices, so the table never grows
+    EdgeTable<EdgeNodes> edges_;
+    // Roots found by queries, valid while their epoch is the current one. Every link and cut
+    // starts a new epoch, so queries between updates climb from each vertex at most once
+    std::vector<CachedRoot> roots_;
+    uint64_t epoch_ = 1;
+    // Vertex nodes never move, so vertices are found by index and snapshots share the table
+    std::shared_ptr<const std::vector<uint32_t>> vertex_nodes_;
     size_t n_vertices_;
+    // Kept between cuts so that cutting allocates nothing
+    std::vector<iterator> cut_points_;
+    std::vector<BST> cut_parts_;
+
+    iterator Vertex(size_t v) {
+        return iterator(&pool_, (*vertex_nodes_)[v]);
+    }
+
+    // The same, returning the tour. Relinking the tour moves roots, so the handle is for updates
+    // of the forest only, which start their epoch here
+    BST Reroot(size_t v) {
+        WriteSection<Pool> section(pool_);
+        ++epoch_;
+        auto parts = Vertex(v).split();
+        parts.second.merge(parts.first);
+        return parts.second;
+    }
+
+    uint32_t Root(size_t v) {
+        CachedRoot& cached = roots_[v];
+        if (cached.epoch_ != epoch_) {
+            cached.root_ = Vertex(v).get_root().index();
+            cached.epoch_ = epoch_;
+        }
+        return cached.root_;
+    }
+
+    void Build(const std::vector<std::pair<size_t, size_t>>& edges) {
+        // Adjacency lists in one array: neighbours of v, with the edges leading to them, are at
+        // [first[v], first[v + 1])
+        std::vector<uint32_t> first(n_vertices_ + 1);
+        for (const auto& edge : edges) {
+            if (edge.first == edge.second) {
+                throw std::runtime_error("Loop is not a valid edge");
+            }
+            if (edge.first >= n_vertices_ || edge.second >= n_vertices_) {
+                throw std::runtime_error("No such vertices in graph");
+            }
+            ++first[edge.first + 1];
+            ++first[edge.second + 1];
+        }
+        for (size_t v = 0; v < n_vertices_; ++v) {
+            first[v + 1] += first[v];
+        }
+        std::vector<std::pair<uint32_t, uint32_t>> adjacent(2 * edges.size());
+        {
+            std::vector<uint32_t> next(first.begin(), first.end() - 1);
+            for (size_t i = 0; i < edges.size(); ++i) {
+                adjacent[next[edges[i].first]++] = {edges[i].second, i};
+                adjacent[next[edges[i].second]++] = {edges[i].first, i};
+            }
+        }
+
+        auto vertex_nodes = std::make_shared<std::vector<uint32_t>>(n_vertices_);
+        std::vector<EdgeNodes> edge_nodes(edges.size());
+        // Edge of the search that reached the vertex. Roots of the search have none
+        const uint32_t no_edge = edges.size(), unvisited = no_edge + 1;
+        std::vector<uint32_t> parent_edge(n_vertices_, unvisited);
+        // Vertices on the search path with the next of their edges to look at
+        std::vector<std::pair<uint32_t, uint32_t>> path;
+        std::vector<typename BST::value_type> tour;
+        std::vector<bool> is_vertex;
+        // The vertex of a vertex node, or twice the edge of a traversal plus one if it goes back
+        std::vector<uint32_t> owners;
+        auto visit = [&](uint32_t v, uint32_t edge) {
+            parent_edge[v] = edge;
+            path.emplace_back(v, first[v]);
+            tour.push_back(v);
+            is_vertex.push_back(true);
+            owners.push_back(v);
+        };
+        for (size_t root = 0; root < n_vertices_; ++root) {
+            if (parent_edge[root] != unvisited) {
+                continue;
+            }
+            tour.clear();
+            is_vertex.clear();
+            owners.clear();
+            visit(root, no_edge);
+            while (!path.empty()) {
+                uint32_t v = path.back().first;
+                if (path.back().second == first[v + 1]) {
+                    path.pop_back();
+                    if (!path.empty()) {
+                        tour.push_back(path.back().first);
+                        is_vertex.push_back(false);
+                        owners.push_back(2 * parent_edge[v] + 1);
+                    }
+                    continue;
+                }
+                auto [u, edge] = adjacent[path.back().second++];
+                if (edge == parent_edge[v]) {
+                    continue;
+                }
+                if (parent_edge[u] != unvisited) {
+                    throw std::runtime_error("Edges do not form a forest");
+                }
+                tour.push_back(u);
+                is_vertex.push_back(false);
+                owners.push_back(2 * edge);
+                visit(u, edge);
+            }
+            // Nodes are recorded as the tree allocates them, so it is not walked again
+            size_t position = 0;
+            BST(tour.begin(), tour.end(), is_vertex.begin(), pool_, [&](uint32_t node) {
+                uint32_t owner = owners[position];
+                if (is_vertex[position++]) {
+                    (*vertex_nodes)[owner] = node;
+                } else if (owner & 1) {
+                    edge_nodes[owner >> 1].back_ = node;
+                } else {
+                    edge_nodes[owner >> 1].straight_ = node;
+                }
+            });
+        }
+        vertex_nodes_ = vertex_nodes;
+        // Traversals are oriented from the parent in the search, as if the edge was added so
+        for (size_t i = 0; i < edges.size(); ++i) {
+            edges_.Insert(EdgeTable<EdgeNodes>::Key(edges[i].first, edges[i].second),
+                          edge_nodes[i]);
+        }
+    }
+
+    // A one-node tour. Its node comes from the pool's free list, where Detach returns the
+    // nodes of cut edges, so relinking allocates nothing
+    BST MakeOccurrence(size_t vertex) {
+        typename BST::value_type value = vertex;
+        return BST(&value, &value + 1, pool_);
+    }
+
+    // Cuts the tour around the node and releases it. The next node is found before the tour is
+    // cut, which spares a descent from the root of the right part
+    std::pair<BST, BST> Detach(const iterator& it) {
+        auto next = it;
+        cut_points_.assign({it, ++next});
+        BST::split_at(cut_points_, &cut_parts_);
+        cut_parts_[1].clear();
+        return std::make_pair(cut_parts_[0], cut_parts_[2]);
+    }
 
-    friend class LevelGraph;
-};
\ No newline at end of file
+    friend class LevelGraph<BST>;
+};
@@ -1,13 +1,15 @@
 #include "level_graph.cpp"
 
+template <class BST = CartesianBST<uint32_t, 2>>
 class DynamicGraph {
 public:
     DynamicGraph() = delete;
     DynamicGraph(size_t n_vertices) : n_vertices_(n_vertices) {
         size_t level = 0u;
-        graphs_.emplace_back(std::make_shared<LevelGraph>(level++, n_vertices, nullptr));
+        graphs_.emplace_back(std::make_shared<LevelGraph<BST>>(level++, n_vertices, nullptr));
         while (1u << level < n_vertices << 1u) {
-            graphs_.emplace_back(std::make_shared<LevelGraph>(level++, n_vertices, graphs_.back()));
+            graphs_.emplace_back(
+                std::make_shared<LevelGraph<BST>>(level++, n_vertices, graphs_.back()));
         }
     }
 
@@ -28,30 +30,27 @@ public:
         if (u >= n_vertices_ || v >= n_vertices_) {
             throw std::runtime_error("No such vertices in graph");
         }
-        auto it = graphs_.rbegin();
-        while (it != graphs_.rend() &&
-               (*it)->edges_at_level_[u].find(v) == (*it)->edges_at_level_[u].end()) {
-            ++it;
+        size_t level = graphs_.size();
+        while (level && !graphs_[level - 1]->has_edge(u, v)) {
+            --level;
         }
-        if (it == graphs_.rend()) {
+        if (!level) {
             throw std::runtime_error("No such edge in graph");
         }
-        std::pair<size_t, size_t> replacement = (*it)->erase_from_level(u, v);
-        if (replacement.first == 0 && replacement.second == 0) {
-            return;
-        }
-        while (it++ != graphs_.rbegin()) {
+        // A tree edge is in the forests of its level and of every level above. The search for
+        // a replacement goes up from its level; above the level it succeeds at, the replacement
+        // takes the place of the edge
+        for (--level; level < graphs_.size(); ++level) {
+            std::pair<size_t, size_t> replacement = graphs_[level]->erase_from_level(u, v);
+            if (replacement.first == 0 && replacement.second == 0) {
+                return;
+            }
             if (replacement.first != 1 || replacement.second != 1) {
-                if (replacement.first == 0 && replacement.second == 0) {
-                    throw std::logic_error("Impossible behaviour");
-                }
-                --it;
-                while (it++ != graphs_.rbegin()) {
-                    (*it)->erase_and_replace(u, v, replacement.first, replacement.second);
+                while (++level < graphs_.size()) {
+                    graphs_[level]->erase_and_replace(u, v, replacement.first, replacement.second);
                 }
-                break;
+                return;
             }
-            replacement = (*it)->erase_from_level(u, v);
         }
     }
 
@@ -65,7 +64,12 @@ public:
         return graphs_.back()->is_connected(u, v);
     }
 
+    // Connectivity as of now, answered from other threads while updates go on
+    typename Forest<BST>::Snapshot snapshot() {
+        return graphs_.back()->spanning_forest_.snapshot();
+    }
+
 private:
-    std::vector<std::shared_ptr<LevelGraph>> graphs_;
+    std::vector<std::shared_ptr<LevelGraph<BST>>> graphs_;
     size_t n_vertices_;
 };
\ No newline at end of file
@@ -1,117 +1,129 @@
 #include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 #include "../../src/forest/simple_forest.cpp"
 
+// Edges of one level of the dynamic graph. Vertices of the spanning forest carry two flags:
+// one for tree edges of the level and one for the rest, so that both scans over a cut off tree
+// visit only vertices with such edges
+template <class BST = CartesianBST<uint32_t, 2>>
 class LevelGraph {
 public:
+    static_assert(BST::kFlags >= 2, "Level graphs flag tree and non-tree edges separately");
+
     LevelGraph() = delete;
     LevelGraph(size_t level, size_t n_vertices, std::shared_ptr<LevelGraph> lower_graph)
         : spanning_forest_(n_vertices), lower_graph_(lower_graph), level_(level) {
     }
 
     void insert_to_level(size_t u, size_t v) {
-        if (edges_at_level_.find(u) == edges_at_level_.end() || edges_at_level_[u].empty()) {
-            spanning_forest_.vertices_[u].set_has_level_edges(true);
-        }
-        edges_at_level_[u].insert(v);
-
-        if (edges_at_level_.find(v) == edges_at_level_.end() || edges_at_level_[v].empty()) {
-            spanning_forest_.vertices_[v].set_has_level_edges(true);
-        }
-        edges_at_level_[v].insert(u);
-
         if (!spanning_forest_.is_connected(u, v)) {
             spanning_forest_.add_new_edge(u, v);
+            AddEdge(kTreeEdges, u, v);
+        } else {
+            AddEdge(kNonTreeEdges, u, v);
         }
     }
 
     std::pair<size_t, size_t> erase_from_level(size_t u, size_t v) {
-        edges_at_level_[u].erase(v);
-        if (edges_at_level_[u].empty()) {
-            spanning_forest_.vertices_[u].set_has_level_edges(false);
+        if (HasEdge(kNonTreeEdges, u, v)) {
+            EraseEdge(kNonTreeEdges, u, v);
+            return std::make_pair(0, 0);
         }
-
-        edges_at_level_[v].erase(u);
-        if (edges_at_level_[v].empty()) {
-            spanning_forest_.vertices_[v].set_has_level_edges(false);
+        // Above its own level a tree edge is only in the forest
+        if (HasEdge(kTreeEdges, u, v)) {
+            EraseEdge(kTreeEdges, u, v);
         }
 
         if (!spanning_forest_.is_connected(u, v)) {
             return std::make_pair(0, 0);
         }
         auto tree_pair = spanning_forest_.erase_existing_edge(u, v);
-        if (tree_pair.second->size() < tree_pair.first->size()) {
+        if (tree_pair.second.size() < tree_pair.first.size()) {
             std::swap(tree_pair.first, tree_pair.second);
         }
 
-        auto it = tree_pair.first->begin(true);
-        while (it != tree_pair.first->end()) {
-            std::unordered_set<size_t> remaining_edges;
-            for (const auto& to : edges_at_level_[*it]) {
-                if (spanning_forest_.is_connected(*it, to)) {
-                    lower_graph_->insert_to_level(*it, to);
-                    edges_at_level_[to].erase(*it);
-                    if (edges_at_level_[to].empty()) {
-                        spanning_forest_.vertices_[to].set_has_level_edges(false);
-                    }
-                } else {
-                    remaining_edges.insert(to);
-                }
-            }
-            edges_at_level_[*it] = std::move(remaining_edges);
-            if (edges_at_level_[*it].empty()) {
-                spanning_forest_.vertices_[*it].set_has_level_edges(false);
+        // Tree edges of the smaller part go one level down. Moving edges changes the flags, so
+        // the flagged vertices are collected before
+        std::vector<typename BST::value_type> flagged;
+        tree_pair.first.collect_flagged(kTreeEdges, &flagged);
+        for (size_t from : flagged) {
+            auto tree_edges = edges_[kTreeEdges][from];
+            for (const auto& to : tree_edges) {
+                EraseEdge(kTreeEdges, from, to);
+                lower_graph_->insert_to_level(from, to);
             }
-            it.next_with_level_edges();
         }
 
-        std::pair<size_t, size_t> replacement = std::make_pair(1, 1);
-        it = tree_pair.first->begin(true);
-        while (it != tree_pair.first->end()) {
-            std::unordered_set<size_t> remaining_edges;
-            bool found_replacement = false;
-            for (const auto& to : edges_at_level_[*it]) {
-                if (found_replacement) {
-                    remaining_edges.insert(to);
-                    continue;
+        // Non-tree edges inside the smaller part go down too, until one leads to the other part
+        flagged.clear();
+        tree_pair.first.collect_flagged(kNonTreeEdges, &flagged);
+        for (size_t from : flagged) {
+            auto non_tree_edges = edges_[kNonTreeEdges][from];
+            for (const auto& to : non_tree_edges) {
+                EraseEdge(kNonTreeEdges, from, to);
+                if (!spanning_forest_.is_connected(from, to)) {
+                    spanning_forest_.add_new_edge(from, to);
+                    AddEdge(kTreeEdges, from, to);
+                    return std::make_pair(from, to);
                 }
-                if (spanning_forest_.is_connected(to, *tree_pair.second->begin())) {
-                    found_replacement = true;
-                    replacement = std::make_pair(*it, to);
-                    spanning_forest_.add_new_edge(*it, to);
-                } else {
-                    lower_graph_->insert_to_level(*it, to);
-                    edges_at_level_[to].erase(*it);
-                    if (edges_at_level_[to].empty()) {
-                        spanning_forest_.vertices_[to].set_has_level_edges(false);
-                    }
-                }
-            }
-            edges_at_level_[*it] = std::move(remaining_edges);
-            if (edges_at_level_[*it].empty()) {
-                spanning_forest_.vertices_[*it].set_has_level_edges(false);
-            }
-            if (found_replacement) {
-                break;
+                lower_graph_->insert_to_level(from, to);
             }
-            it.next_with_level_edges();
         }
-        return replacement;
+        return std::make_pair(1, 1);
     }
 
+    // Levels above the one an erased tree edge was replaced at only swap the edges in their
+    // forests: both are tree edges there and neither is in the adjacency of the level
     void erase_and_replace(size_t u, size_t v, size_t new_u, size_t new_v) {
+        spanning_forest_.erase_existing_edge(u, v);
+        spanning_forest_.add_new_edge(new_u, new_v);
     }
 
     bool is_connected(size_t u, size_t v) {
         return spanning_forest_.is_connected(u, v);
     }
 
+    bool has_edge(size_t u, size_t v) {
+        return HasEdge(kTreeEdges, u, v) || HasEdge(kNonTreeEdges, u, v);
+    }
+
 private:
-    Forest spanning_forest_;
+    static constexpr size_t kTreeEdges = 0;
+    static constexpr size_t kNonTreeEdges = 1;
+
+    Forest<BST> spanning_forest_;
     std::shared_ptr<LevelGraph> lower_graph_;
-    std::unordered_map<size_t, std::unordered_set<size_t>> edges_at_level_;
+    // Adjacency of the level, tree edges and the rest apart
+    std::unordered_map<size_t, std::unordered_set<size_t>> edges_[2];
     size_t level_;
 
+    bool HasEdge(size_t kind, size_t u, size_t v) {
+        auto found = edges_[kind].find(u);
+        return found != edges_[kind].end() && found->second.count(v);
+    }
+
+    // Both keep the flag of a vertex set while it has edges of the kind
+    void AddEdge(size_t kind, size_t u, size_t v) {
+        for (auto [from, to] : {std::make_pair(u, v), std::make_pair(v, u)}) {
+            auto& adjacent = edges_[kind][from];
+            if (adjacent.empty()) {
+                spanning_forest_.Vertex(from).set_flag(kind, true);
+            }
+            adjacent.insert(to);
+        }
+    }
+    void EraseEdge(size_t kind, size_t u, size_t v) {
+        for (auto [from, to] : {std::make_pair(u, v), std::make_pair(v, u)}) {
+            auto& adjacent = edges_[kind][from];
+            adjacent.erase(to);
+            if (adjacent.empty()) {
+                spanning_forest_.Vertex(from).set_flag(kind, false);
+            }
+        }
+    }
+
+    template <class>
     friend class DynamicGraph;
 };
\ No newline at end of file
@@ -0,0 +1,240 @@
+#define CATCH_CONFIG_MAIN
+
+#include <algorithm>
+#include <random>
+
+#include "../../src/bst/b_tree_bst.h"
+#include "../../src/bst/cartesian_bst.h"
+#include "../../src/bst/skip_list_bst.h"
+#include "../../src/bst/splay_bst.h"
+#include "../catch/catch.hpp"
+
+// Properties every sequence tree shares. Tests of what only one of them has are in its own file
+
+template <class Tree, class Iterable>
+void CheckTreeContent(const Tree& tree, const Iterable& arr) {
+    auto lit = tree.begin();
+    auto rit = arr.begin();
+    while (lit != tree.end() && rit != arr.end()) {
+        CHECK(*lit++ == *rit++);
+    }
+    CHECK(lit == tree.end());
+    CHECK(rit == arr.end());
+}
+
+TEMPLATE_TEST_CASE("Test backend creates", "", CartesianBST<int>, SplayBST<int>,
+                   SkipListBST<int>, BTreeBST<int>) {
+    typename TestType::Pool pool;
+    std::vector<int> values(1000);
+    for (size_t i = 0; i < values.size(); ++i) {
+        values[i] = i;
+    }
+    TestType tree(values.begin(), values.end(), pool);
+    CheckTreeContent(tree, values);
+    CHECK(*--tree.end() == 999);
+    CHECK_THROWS_AS(--tree.begin(), std::runtime_error);
+
+    std::vector<int> empty_values = {};
+    TestType empty_tree(empty_values.begin(), empty_values.end(), pool);
+    CHECK(empty_tree.empty());
+    CHECK(empty_tree.begin() == empty_tree.end());
+    CHECK_THROWS_AS(++empty_tree.begin(), std::runtime_error);
+    CHECK_THROWS_AS(--empty_tree.end(), std::runtime_error);
+}
+
+TEMPLATE_TEST_CASE("Test backend split and merge", "", CartesianBST<int>, SplayBST<int>,
+                   SkipListBST<int>, BTreeBST<int>) {
+    typename TestType::Pool pool;
+    std::vector<int> lhs_vals = {1, 2};
+    std::vector<int> rhs_vals = {2, 3, 4, 5};
+    TestType lhs_tree(lhs_vals.begin(), lhs_vals.end(), pool);
+    TestType rhs_tree(rhs_vals.begin(), rhs_vals.end(), pool);
+    auto it = rhs_tree.begin();
+    ++it, ++it;
+    auto tree_pair = it.split();
+    SECTION("Merge works consecutive") {
+        lhs_tree.merge(tree_pair.first);
+        CheckTreeContent(lhs_tree, std::vector<int>({1, 2, 2, 3}));
+        CheckTreeContent(tree_pair.second, std::vector<int>({4, 5}));
+    }
+    SECTION("Merge works always") {
+        lhs_tree.merge(tree_pair.second);
+        CheckTreeContent(lhs_tree, std::vector<int>({1, 2, 4, 5}));
+        CheckTreeContent(tree_pair.first, std::vector<int>({2, 3}));
+    }
+    SECTION("Split at begin") {
+        auto begin_pair = lhs_tree.begin().split();
+        CHECK(begin_pair.first.empty());
+        CheckTreeContent(begin_pair.second, lhs_vals);
+    }
+}
+
+TEMPLATE_TEST_CASE("Test backend roots identify trees", "", CartesianBST<int>, SplayBST<int>,
+                   SkipListBST<int>, BTreeBST<int>) {
+    typename TestType::Pool pool;
+    std::vector<int> vals = {0, 1, 2, 3, 4, 5, 6, 7};
+    TestType tree(vals.begin(), vals.end(), pool);
+    std::vector<typename TestType::iterator> nodes;
+    for (auto it = tree.begin(); it != tree.end(); ++it) {
+        nodes.emplace_back(it);
+    }
+    auto tree_pair = nodes[3].split();
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        for (size_t j = 0; j < nodes.size(); ++j) {
+            CHECK((nodes[i].get_root() == nodes[j].get_root()) == ((i < 3) == (j < 3)));
+        }
+    }
+    tree_pair.second.merge(tree_pair.first);
+    CHECK(nodes[0].get_root() == nodes[7].get_root());
+    CheckTreeContent(tree_pair.second, std::vector<int>({3, 4, 5, 6, 7, 0, 1, 2}));
+}
+
+TEMPLATE_TEST_CASE("Test backend flags", "", CartesianBST<int>, SplayBST<int>, SkipListBST<int>,
+                   BTreeBST<int>) {
+    typename TestType::Pool pool;
+    std::vector<int> vals(300);
+    for (size_t i = 0; i < vals.size(); ++i) {
+        vals[i] = i;
+    }
+    TestType tree(vals.begin(), vals.end(), pool);
+    std::vector<int> flagged;
+    for (auto it = tree.begin(); it != tree.end(); ++it) {
+        it.set_is_vertex(*it % 2 == 0);
+        if (*it % 7 == 3 || *it == 299) {
+            it.set_has_level_edges(true);
+            flagged.emplace_back(*it);
+        }
+    }
+    CHECK(tree.size() == 150);
+    std::vector<int> result;
+    for (auto it = tree.begin(true); it != tree.end(); it.next_with_level_edges()) {
+        result.emplace_back(*it);
+    }
+    CHECK(result == flagged);
+    auto it = tree.begin();
+    for (size_t i = 0; i < 101; ++i) {
+        ++it;
+    }
+    auto tree_pair = it.split();
+    CHECK(tree_pair.first.size() == 51);
+    CHECK(tree_pair.second.size() == 99);
+    CHECK(*tree_pair.second.begin(true) == 101);
+}
+
+TEMPLATE_TEST_CASE("Test backend several flags", "", (CartesianBST<int, 3>), (SplayBST<int, 3>),
+                   (SkipListBST<int, 3>), (BTreeBST<int, 3>)) {
+    typename TestType::Pool pool;
+    std::vector<int> vals(300);
+    for (size_t i = 0; i < vals.size(); ++i) {
+        vals[i] = i;
+    }
+    TestType tree(vals.begin(), vals.end(), pool);
+    for (auto it = tree.begin(); it != tree.end(); ++it) {
+        for (size_t flag = 0; flag < TestType::kFlags; ++flag) {
+            it.set_flag(flag, *it % (flag + 2) == 0);
+        }
+    }
+    auto it = tree.begin();
+    for (size_t i = 0; i < 125; ++i) {
+        ++it;
+    }
+    auto tree_pair = it.split();
+    tree_pair.second.merge(tree_pair.first);
+    for (size_t flag = 0; flag < TestType::kFlags; ++flag) {
+        std::vector<int> expected, result;
+        for (auto cur = tree_pair.second.begin(); cur != tree_pair.second.end(); ++cur) {
+            if (*cur % (flag + 2) == 0) {
+                expected.emplace_back(*cur);
+            }
+        }
+        auto cur = tree_pair.second.begin_flagged(flag);
+        for (; cur != tree_pair.second.end(); cur.next_flagged(flag)) {
+            CHECK(cur.has_flag(flag));
+            result.emplace_back(*cur);
+        }
+        CHECK(result == expected);
+        std::vector<int> collected;
+        tree_pair.second.collect_flagged(flag, &collected);
+        CHECK(collected == expected);
+    }
+    tree_pair.second.begin_flagged(1).set_flag(1, false);
+    CHECK(*tree_pair.second.begin_flagged(1) == 129);
+    CHECK(*tree_pair.second.begin(true) == 126);
+}
+
+TEMPLATE_TEST_CASE("Test backend split_at and merge_all", "", CartesianBST<int>, SplayBST<int>,
+                   SkipListBST<int>, BTreeBST<int>) {
+    typename TestType::Pool pool;
+    std::mt19937 gen(7);
+    std::vector<int> vals(500);
+    for (size_t i = 0; i < vals.size(); ++i) {
+        vals[i] = i;
+    }
+    TestType tree(vals.begin(), vals.end(), pool);
+    std::vector<typename TestType::iterator> nodes;
+    for (auto it = tree.begin(); it != tree.end(); ++it) {
+        nodes.emplace_back(it);
+    }
+    std::vector<typename TestType::iterator> points;
+    std::vector<TestType> parts;
+    for (size_t round = 0; round < 30; ++round) {
+        // Repeated points and the end give empty parts
+        std::vector<size_t> cuts(gen() % 6 + 1);
+        for (size_t& cut : cuts) {
+            cut = gen() % (vals.size() + 1);
+        }
+        std::sort(cuts.begin(), cuts.end());
+        points.clear();
+        for (size_t cut : cuts) {
+            points.emplace_back(cut < vals.size() ? nodes[vals[cut]] : tree.end());
+        }
+        TestType::split_at(points, &parts);
+        REQUIRE(parts.size() == cuts.size() + 1);
+        size_t from = 0;
+        for (size_t i = 0; i < parts.size(); ++i) {
+            size_t to = i < cuts.size() ? cuts[i] : vals.size();
+            CheckTreeContent(parts[i], std::vector<int>(vals.begin() + from, vals.begin() + to));
+            from = to;
+        }
+        std::shuffle(parts.begin(), parts.end(), gen);
+        tree = parts.front();
+        tree.merge_all(std::vector<TestType>(parts.begin() + 1, parts.end()));
+        vals.clear();
+        for (auto it = tree.begin(); it != tree.end(); ++it) {
+            vals.emplace_back(*it);
+        }
+        REQUIRE(vals.size() == 500);
+    }
+    TestType::split_at({tree.begin()}, &parts);
+    CHECK(parts[0].empty());
+    CheckTreeContent(parts[1], vals);
+    CHECK_THROWS_AS(TestType::split_at({}, &parts), std::logic_error);
+}
+
+TEMPLATE_TEST_CASE("Test backend random rotations", "", CartesianBST<int>, SplayBST<int>,
+                   SkipListBST<int>, BTreeBST<int>) {
+    typename TestType::Pool pool;
+    std::mt19937 gen(42);
+    std::vector<int> vals(1000);
+    for (size_t i = 0; i < vals.size(); ++i) {
+        vals[i] = i;
+    }
+    TestType tree(vals.begin(), vals.end(), pool);
+    std::vector<typename TestType::iterator> nodes;
+    for (auto it = tree.begin(); it != tree.end(); ++it) {
+        nodes.emplace_back(it);
+    }
+    std::vector<int> expected = vals;
+    for (size_t step = 0; step < 200; ++step) {
+        int cut = gen() % vals.size();
+        auto tree_pair = nodes[cut].split();
+        tree_pair.second.merge(tree_pair.first);
+        tree = tree_pair.second;
+        std::rotate(expected.begin(), std::find(expected.begin(), expected.end(), cut),
+                    expected.end());
+        REQUIRE(nodes[cut].get_root() == nodes[expected.back()].get_root());
+    }
+    CheckTreeContent(tree, expected);
+    tree.clear();
+    CHECK(pool.Used() == 0);
+}
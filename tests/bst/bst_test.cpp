@@ -1,9 +1,16 @@
 #define CATCH_CONFIG_MAIN
 
-#include "../../src/bst/bst_interface.h"
+#include <algorithm>
+#include <random>
+#include <thread>
+
+#include "../../src/bst/bst_adapter.h"
 #include "../../src/bst/cartesian_bst.h"
 #include "../catch/catch.hpp"
 
+template <class T>
+using VirtualBST = BSTAdapter<CartesianBST<T>>;
+
 template <class TreePtr, class Iterable>
 void CheckTreeContent(const TreePtr ptr, const Iterable& arr) {
     auto lit = ptr->begin();
@@ -18,7 +25,7 @@ void CheckTreeContent(const TreePtr ptr, const Iterable& arr) {
 TEST_CASE("Test BST creates") {
     std::vector<char> values = {'a', 'b', 'c', 'd', 'e'};
     std::shared_ptr<IBST<char>> tree;
-    REQUIRE_NOTHROW(tree = std::make_shared<CartesianBST<char>>(values.begin(), values.end()));
+    REQUIRE_NOTHROW(tree = std::make_shared<VirtualBST<char>>(values.begin(), values.end()));
     SECTION("Iterators work") {
         std::vector<char> result;
         for (auto elem : *tree) {
@@ -34,7 +41,7 @@ TEST_CASE("Test BST creates") {
 TEST_CASE("Test empty") {
     std::vector<char> values = {};
     std::shared_ptr<IBST<char>> tree;
-    REQUIRE_NOTHROW(tree = std::make_shared<CartesianBST<char>>(values.begin(), values.end()));
+    REQUIRE_NOTHROW(tree = std::make_shared<VirtualBST<char>>(values.begin(), values.end()));
     SECTION("Empty iterators are ok") {
         REQUIRE_NOTHROW(tree->begin());
         REQUIRE_NOTHROW(tree->end());
@@ -60,7 +67,7 @@ TEST_CASE("Test empty") {
 TEST_CASE("Test one element") {
     std::vector<char> values = {42};
     std::shared_ptr<IBST<char>> tree;
-    REQUIRE_NOTHROW(tree = std::make_shared<CartesianBST<char>>(values.begin(), values.end()));
+    REQUIRE_NOTHROW(tree = std::make_shared<VirtualBST<char>>(values.begin(), values.end()));
     SECTION("One element iterators are ok") {
         REQUIRE_NOTHROW(tree->begin());
         REQUIRE_NOTHROW(tree->end());
@@ -98,9 +105,9 @@ TEST_CASE("Test simple merge") {
     std::vector<int> lhs_vals = {1, 2, 3};
     std::vector<int> rhs_vals = {4, 5, 6};
     std::shared_ptr<IBST<int>> lhs_tree =
-        std::make_shared<CartesianBST<int>>(lhs_vals.begin(), lhs_vals.end());
+        std::make_shared<VirtualBST<int>>(lhs_vals.begin(), lhs_vals.end());
     std::shared_ptr<IBST<int>> rhs_tree =
-        std::make_shared<CartesianBST<int>>(rhs_vals.begin(), rhs_vals.end());
+        std::make_shared<VirtualBST<int>>(rhs_vals.begin(), rhs_vals.end());
     lhs_tree->merge(rhs_tree);
     CheckTreeContent(lhs_tree, std::vector<int>({1, 2, 3, 4, 5, 6}));
 }
@@ -109,9 +116,9 @@ TEST_CASE("Test merge same") {
     std::vector<int> lhs_vals = {2, 2};
     std::vector<int> rhs_vals = {2, 2, 2, 2};
     std::shared_ptr<IBST<int>> lhs_tree =
-        std::make_shared<CartesianBST<int>>(lhs_vals.begin(), lhs_vals.end());
+        std::make_shared<VirtualBST<int>>(lhs_vals.begin(), lhs_vals.end());
     std::shared_ptr<IBST<int>> rhs_tree =
-        std::make_shared<CartesianBST<int>>(rhs_vals.begin(), rhs_vals.end());
+        std::make_shared<VirtualBST<int>>(rhs_vals.begin(), rhs_vals.end());
     lhs_tree->merge(rhs_tree);
     CheckTreeContent(lhs_tree, std::vector<int>({2, 2, 2, 2, 2, 2}));
 }
@@ -120,9 +127,9 @@ TEST_CASE("Test merge empty") {
     std::vector<int> lhs_vals = {2, 2};
     std::vector<int> rhs_vals = {};
     std::shared_ptr<IBST<int>> lhs_tree =
-        std::make_shared<CartesianBST<int>>(lhs_vals.begin(), lhs_vals.end());
+        std::make_shared<VirtualBST<int>>(lhs_vals.begin(), lhs_vals.end());
     std::shared_ptr<IBST<int>> rhs_tree =
-        std::make_shared<CartesianBST<int>>(rhs_vals.begin(), rhs_vals.end());
+        std::make_shared<VirtualBST<int>>(rhs_vals.begin(), rhs_vals.end());
     SECTION("Empty on rhs") {
         lhs_tree->merge(rhs_tree);
         CheckTreeContent(lhs_tree, std::vector<int>({2, 2}));
@@ -133,7 +140,7 @@ TEST_CASE("Test merge empty") {
     }
     SECTION("Empty on both") {
         std::shared_ptr<IBST<int>> empty_tree =
-            std::make_shared<CartesianBST<int>>(rhs_vals.begin(), rhs_vals.end());
+            std::make_shared<VirtualBST<int>>(rhs_vals.begin(), rhs_vals.end());
         rhs_tree->merge(empty_tree);
         CheckTreeContent(rhs_tree, std::vector<int>({}));
     }
@@ -141,7 +148,7 @@ TEST_CASE("Test merge empty") {
 
 TEST_CASE("Test simple split") {
     std::vector<int> vals = {1, 2, 3, 4, 5, 6};
-    std::shared_ptr<IBST<int>> tree = std::make_shared<CartesianBST<int>>(vals.begin(), vals.end());
+    std::shared_ptr<IBST<int>> tree = std::make_shared<VirtualBST<int>>(vals.begin(), vals.end());
     auto it = tree->begin();
     ++it, ++it, ++it;
     auto tree_pair = it.split();
@@ -151,7 +158,7 @@ TEST_CASE("Test simple split") {
 
 TEST_CASE("Test split same") {
     std::vector<int> vals = {5, 5, 5, 5, 5, 5};
-    std::shared_ptr<IBST<int>> tree = std::make_shared<CartesianBST<int>>(vals.begin(), vals.end());
+    std::shared_ptr<IBST<int>> tree = std::make_shared<VirtualBST<int>>(vals.begin(), vals.end());
     auto it = tree->begin();
     ++it, ++it, ++it, ++it;
     auto tree_pair = it.split();
@@ -163,9 +170,9 @@ TEST_CASE("Test split and merge") {
     std::vector<int> lhs_vals = {1, 2};
     std::vector<int> rhs_vals = {2, 3, 4, 5};
     std::shared_ptr<IBST<int>> lhs_tree =
-        std::make_shared<CartesianBST<int>>(lhs_vals.begin(), lhs_vals.end());
+        std::make_shared<VirtualBST<int>>(lhs_vals.begin(), lhs_vals.end());
     std::shared_ptr<IBST<int>> rhs_tree =
-        std::make_shared<CartesianBST<int>>(rhs_vals.begin(), rhs_vals.end());
+        std::make_shared<VirtualBST<int>>(rhs_vals.begin(), rhs_vals.end());
     auto it = rhs_tree->begin();
     ++it, ++it;
     auto tree_pair = it.split();
@@ -183,7 +190,7 @@ TEST_CASE("Test split and merge") {
 
 TEST_CASE("Test iterators are not same") {
     std::vector<int> vals = {1, 2, 3, 4, 5, 6};
-    std::shared_ptr<IBST<int>> tree = std::make_shared<CartesianBST<int>>(vals.begin(), vals.end());
+    std::shared_ptr<IBST<int>> tree = std::make_shared<VirtualBST<int>>(vals.begin(), vals.end());
     auto it = tree->begin();
     SECTION("Way #1") {
         auto new_it = tree->begin();
@@ -205,5 +212,452 @@ TEST_CASE("Test iterators are not same") {
     }
 }
 
+TEST_CASE("Test sizes through merge and split") {
+    std::vector<int> lhs_vals(20, 1);
+    std::vector<int> rhs_vals(30, 2);
+    std::shared_ptr<IBST<int>> lhs_tree =
+        std::make_shared<VirtualBST<int>>(lhs_vals.begin(), lhs_vals.end());
+    std::shared_ptr<IBST<int>> rhs_tree =
+        std::make_shared<VirtualBST<int>>(rhs_vals.begin(), rhs_vals.end());
+    for (auto it = lhs_tree->begin(); it != lhs_tree->end(); ++it) {
+        it.set_is_vertex(true);
+    }
+    for (auto it = rhs_tree->begin(); it != rhs_tree->end(); ++it) {
+        it.set_is_vertex(true);
+    }
+    lhs_tree->merge(rhs_tree);
+    CHECK(lhs_tree->size() == 50);
+    auto it = lhs_tree->begin();
+    for (size_t i = 0; i < 15; ++i) {
+        ++it;
+    }
+    auto tree_pair = it.split();
+    CHECK(tree_pair.first->size() == 15);
+    CHECK(tree_pair.second->size() == 35);
+}
+
+TEST_CASE("Test iteration with level edges") {
+    std::vector<int> vals = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+    std::shared_ptr<IBST<int>> tree = std::make_shared<VirtualBST<int>>(vals.begin(), vals.end());
+    std::vector<int> flagged = {1, 2, 5, 10, 11};
+    for (auto it = tree->begin(); it != tree->end(); ++it) {
+        if (std::find(flagged.begin(), flagged.end(), *it) != flagged.end()) {
+            it.set_has_level_edges(true);
+        }
+    }
+    std::vector<int> result;
+    for (auto it = tree->begin(true); it != tree->end(); it.next_with_level_edges()) {
+        result.emplace_back(*it);
+    }
+    CHECK(result == flagged);
+}
+
+TEST_CASE("Test pool reuses released nodes") {
+    CartesianBST<int>::Pool pool;
+    std::vector<int> vals = {1, 2, 3, 4, 5, 6};
+    std::shared_ptr<IBST<int>> tree =
+        std::make_shared<VirtualBST<int>>(vals.begin(), vals.end(), pool);
+    CHECK(pool.Used() == 6);
+    auto tree_pair = (++tree->begin()).split();
+    tree_pair.first->clear();
+    CHECK(tree_pair.first->empty());
+    CHECK(pool.Used() == 5);
+    std::vector<int> more_vals = {7};
+    std::shared_ptr<IBST<int>> other =
+        std::make_shared<VirtualBST<int>>(more_vals.begin(), more_vals.end(), pool);
+    CHECK(pool.Used() == 6);
+    tree_pair.second->merge(other);
+    CheckTreeContent(tree_pair.second, std::vector<int>({2, 3, 4, 5, 6, 7}));
+}
+
+TEST_CASE("Test cleared trees keep the pool flat") {
+    CartesianBST<int>::Pool pool;
+    std::vector<int> vals(100);
+    for (size_t i = 0; i < vals.size(); ++i) {
+        vals[i] = i;
+    }
+    // Handles are dropped after every split and merge; only clear() gives nodes back
+    for (size_t run = 0; run < 50; ++run) {
+        std::shared_ptr<IBST<int>> tree =
+            std::make_shared<VirtualBST<int>>(vals.begin(), vals.end(), pool);
+        auto tree_pair = tree->kth(run).split();
+        tree_pair.second->merge(tree_pair.first);
+        auto parts = tree_pair.second->split_at({tree_pair.second->kth(10 + run)});
+        parts[1]->merge_all({parts[0]});
+        CHECK(pool.Used() == vals.size());
+        parts[1]->clear();
+        REQUIRE(pool.Used() == 0);
+    }
+    {
+        std::shared_ptr<IBST<int>> dropped =
+            std::make_shared<VirtualBST<int>>(vals.begin(), vals.end(), pool);
+    }
+    CHECK(pool.Used() == vals.size());
+}
+
+TEST_CASE("Test a write after a snapshot copies one block") {
+    NodePool<int> pool;
+    std::vector<uint32_t> indices;
+    for (int i = 0; i < 100000; ++i) {
+        indices.emplace_back(pool.Allocate(i));
+    }
+    auto snapshot = pool.TakeSnapshot();
+    pool[indices[50000]] = -1;
+    CHECK(pool.Copied() == NodePool<int>::kBlockSize);
+    pool[indices[50001]] = -2;
+    CHECK(pool.Copied() == NodePool<int>::kBlockSize);
+    CHECK(pool[indices[50000]] == -1);
+    CHECK(snapshot[indices[50000]] == 50000);
+    CHECK(snapshot[indices[50001]] == 50001);
+    // Without snapshots writes copy nothing
+    snapshot = NodePool<int>::Snapshot();
+    pool[indices[0]] = -3;
+    CHECK(pool.Copied() == NodePool<int>::kBlockSize);
+
+    // A flag changes a node and its ancestors, each copies at most its block
+    CartesianBST<int>::Pool tree_pool;
+    std::vector<int> vals(indices.size());
+    CartesianBST<int> tree(vals.begin(), vals.end(), tree_pool);
+    auto it = tree.kth(vals.size() / 2);
+    auto tree_snapshot = tree_pool.TakeSnapshot();
+    it.set_has_level_edges(true);
+    CHECK(tree_pool.Copied() > 0);
+    CHECK(tree_pool.Copied() <= (it.depth() + 1) * CartesianBST<int>::Pool::kBlockSize);
+    CHECK(!tree_snapshot[it.index()].HasFlag(0));
+}
+
+TEST_CASE("Test bulk construction") {
+    const size_t n_values = 100'000;
+    std::vector<size_t> vals(n_values);
+    std::vector<bool> is_vertex(n_values);
+    for (size_t i = 0; i < n_values; ++i) {
+        vals[i] = i;
+        is_vertex[i] = i % 3 == 0;
+    }
+    CartesianBST<size_t>::Pool pool;
+    CartesianBST<size_t> tree(vals.begin(), vals.end(), is_vertex.begin(), pool);
+    CHECK(tree.size() == (n_values + 2) / 3);
+    size_t expected = 0;
+    for (auto it = tree.begin(); it != tree.end(); ++it) {
+        REQUIRE(*it == expected++);
+    }
+    CHECK(expected == n_values);
+    auto tree_pair = (++tree.begin()).split();
+    CHECK(tree_pair.first.size() == 1);
+    CHECK(tree_pair.second.size() == (n_values + 2) / 3 - 1);
+}
+
+TEST_CASE("Test order statistics") {
+    std::vector<int> vals(100);
+    for (size_t i = 0; i < vals.size(); ++i) {
+        vals[i] = i;
+    }
+    std::shared_ptr<IBST<int>> lhs = std::make_shared<VirtualBST<int>>(vals.begin(), vals.end());
+    std::shared_ptr<IBST<int>> rhs = std::make_shared<VirtualBST<int>>(vals.begin(), vals.end());
+    for (auto it = lhs->begin(); it != lhs->end(); ++it) {
+        it.set_is_vertex(*it % 3 == 0);
+    }
+    lhs->merge(rhs);
+    CHECK(lhs->index_of(lhs->begin()) == 0);
+    CHECK(lhs->index_of(lhs->end()) == 200);
+    CHECK(lhs->index_of(lhs->end(), true) == 34);
+    size_t index = 0, vertex_index = 0;
+    for (auto it = lhs->begin(); it != lhs->end(); ++it, ++index) {
+        CHECK(lhs->index_of(it) == index);
+        CHECK(lhs->index_of(it, true) == vertex_index);
+        CHECK(lhs->kth(index) == it);
+        if (index < 100 && *it % 3 == 0) {
+            CHECK(lhs->kth(vertex_index, true) == it);
+            ++vertex_index;
+        }
+    }
+    CHECK(lhs->kth(200) == lhs->end());
+    CHECK(lhs->kth(34, true) == lhs->end());
+
+    auto tree_pair = lhs->kth(150).split();
+    CHECK(*tree_pair.second->kth(0) == 50);
+    CHECK(tree_pair.second->index_of(tree_pair.second->kth(10)) == 10);
+    CHECK(tree_pair.first->index_of(tree_pair.first->end(), true) == 34);
+}
+
+TEST_CASE("Test several flags") {
+    std::vector<int> vals(60);
+    for (size_t i = 0; i < vals.size(); ++i) {
+        vals[i] = i;
+    }
+    CartesianBST<int, 3>::Pool pool;
+    CartesianBST<int, 3> tree(vals.begin(), vals.end(), pool);
+    for (auto it = tree.begin(); it != tree.end(); ++it) {
+        for (size_t flag = 0; flag < 3; ++flag) {
+            it.set_flag(flag, *it % (flag + 2) == 0);
+        }
+    }
+    auto tree_pair = tree.kth(25).split();
+    tree_pair.second.merge(tree_pair.first);
+    for (size_t flag = 0; flag < 3; ++flag) {
+        std::vector<int> expected, result;
+        for (auto it = tree_pair.second.begin(); it != tree_pair.second.end(); ++it) {
+            if (*it % (flag + 2) == 0) {
+                expected.emplace_back(*it);
+            }
+        }
+        auto it = tree_pair.second.begin_flagged(flag);
+        for (; it != tree_pair.second.end(); it.next_flagged(flag)) {
+            CHECK(it.has_flag(flag));
+            result.emplace_back(*it);
+        }
+        CHECK(result == expected);
+        std::vector<int> collected;
+        tree_pair.second.collect_flagged(flag, &collected);
+        CHECK(collected == expected);
+    }
+    tree_pair.second.begin_flagged(1).set_flag(1, false);
+    CHECK(*tree_pair.second.begin_flagged(1) == 30);
+    CHECK(*tree_pair.second.begin(true) == 26);
+}
+
+// Composes affine maps x -> a * x + b, which is associative but not commutative
+struct AffineAggregate {
+    typedef std::pair<int64_t, int64_t> value_type;
+
+    static value_type Identity() {
+        return {1, 0};
+    }
+    static value_type Combine(const value_type& lhs, const value_type& rhs) {
+        const int64_t kModulo = 1'000'003;
+        return {lhs.first * rhs.first % kModulo, (lhs.second * rhs.first + rhs.second) % kModulo};
+    }
+};
+
+TEST_CASE("Test aggregates through split and merge") {
+    std::vector<int> vals(300);
+    for (size_t i = 0; i < vals.size(); ++i) {
+        vals[i] = i;
+    }
+    typedef CartesianBST<int, 1, AffineAggregate> Tree;
+    Tree::Pool pool;
+    Tree tree(vals.begin(), vals.end(), pool);
+    for (auto it = tree.begin(); it != tree.end(); ++it) {
+        it.set_payload({*it % 7 + 1, *it});
+    }
+    auto expected = [](const Tree& part) {
+        auto result = AffineAggregate::Identity();
+        for (auto it = part.begin(); it != part.end(); ++it) {
+            result = AffineAggregate::Combine(result, it.payload());
+        }
+        return result;
+    };
+    CHECK(tree.aggregate() == expected(tree));
+    auto first = tree.kth(100).split();
+    auto second = first.second.kth(150).split();
+    CHECK(first.first.aggregate() == expected(first.first));
+    CHECK(second.first.begin().tree_aggregate() == expected(second.first));
+    CHECK(second.second.aggregate() == expected(second.second));
+    second.second.merge(first.first);
+    second.first.kth(20).set_payload({3, 5});
+    second.second.merge(second.first);
+    CHECK(second.second.aggregate() == expected(second.second));
+
+    CartesianBST<int, 1, MinAggregate<int>>::Pool min_pool;
+    CartesianBST<int, 1, MinAggregate<int>> min_tree(vals.begin(), vals.end(), min_pool);
+    CHECK(min_tree.aggregate() == std::numeric_limits<int>::max());
+    min_tree.kth(42).set_payload(-1);
+    CHECK(min_tree.aggregate() == -1);
+}
+
+TEST_CASE("Test seeded shapes are reproducible") {
+    std::vector<int> vals(1000);
+    for (size_t i = 0; i < vals.size(); ++i) {
+        vals[i] = i;
+    }
+    // Root of the tree built after seeding, together with the position of the root
+    auto build = [&vals](uint64_t seed) {
+        PriorityGenerator::seed(seed);
+        CartesianBST<int>::Pool pool;
+        CartesianBST<int> tree(vals.begin(), vals.end(), pool);
+        return std::make_pair(*tree.begin().get_root(), tree.begin().get_root().index());
+    };
+    auto expected = build(7);
+    CHECK(build(7) == expected);
+    CHECK(build(8) != expected);
+
+    std::pair<int, uint32_t> results[2];
+    std::thread first([&] { results[0] = build(7); });
+    std::thread second([&] { results[1] = build(7); });
+    first.join();
+    second.join();
+    CHECK(results[0] == expected);
+    CHECK(results[1] == expected);
+}
+
+TEST_CASE("Test compact nodes") {
+    CHECK(sizeof(CartesianBST<uint32_t>::Pool::value_type) == 32);
+    CHECK(sizeof(CartesianBST<uint32_t, 2>::Pool::value_type) == 32);
+    CHECK(sizeof(CartesianBST<uint32_t, 7>::Pool::value_type) == 32);
+
+    std::vector<uint32_t> vals = {7, 8, 9, 10};
+    CartesianBST<uint32_t, 7>::Pool pool;
+    CartesianBST<uint32_t, 7> tree(vals.begin(), vals.end(), pool);
+    auto it = tree.kth(2);
+    it.set_is_vertex(true);
+    for (size_t flag = 0; flag < 7; ++flag) {
+        it.set_flag(flag, true);
+    }
+    it.set_flag(3, false);
+    CHECK(tree.size() == 1);
+    CHECK(*tree.begin_flagged(6) == 9);
+    CHECK(tree.begin_flagged(3) == tree.end());
+    it.set_is_vertex(false);
+    CHECK(tree.size() == 0);
+    CHECK(it.has_flag(6));
+
+    // A subtree keeps a flag while any of its nodes has it
+    auto next = it;
+    (++next).set_flag(6, true);
+    it.set_flag(6, false);
+    CHECK(*tree.begin_flagged(6) == 10);
+    next.set_flag(6, false);
+    CHECK(tree.begin_flagged(6) == tree.end());
+    CHECK(tree.shape().is_valid());
+}
+
+TEST_CASE("Test shape statistics") {
+    PriorityGenerator::seed(11);
+    std::vector<int> vals(1000);
+    for (size_t i = 0; i < vals.size(); ++i) {
+        vals[i] = i;
+    }
+    CartesianBST<int>::Pool pool;
+    CartesianBST<int> tree(vals.begin(), vals.end(), pool);
+    auto tree_pair = tree.kth(400).split();
+    tree_pair.first.merge(tree_pair.second);
+    auto shape = tree_pair.first.shape();
+    CHECK(shape.is_valid());
+    CHECK(shape.n_nodes_ == 1000);
+    CHECK(shape.tree_sizes_ == std::vector<size_t>{1000});
+    CHECK(shape.depth_counts_[0] == 1);
+    size_t total = 0;
+    for (size_t count : shape.depth_counts_) {
+        total += count;
+    }
+    CHECK(total == 1000);
+    CHECK(shape.height() < 40);
+    CHECK(shape.average_depth() < 20);
+    CHECK(tree_pair.first.sample_depth(50) < 20);
+    CHECK(tree_pair.first.kth(0).depth() + 1 <= shape.height());
+
+    // A handle kept after its tree was merged below another root is no longer a tree. Of the
+    // two old roots only one stays on top, the other one gets a parent
+    std::vector<int> one = {1000};
+    CartesianBST<int> single(one.begin(), one.end(), pool);
+    auto old_lhs = tree_pair.first;
+    auto old_rhs = single;
+    tree_pair.first.merge(single);
+    bool single_on_top = tree_pair.first.begin().get_root() == old_rhs.begin();
+    const auto& stale = single_on_top ? old_lhs : old_rhs;
+    auto stale_shape = stale.shape();
+    CHECK(!stale_shape.is_valid());
+    CHECK(stale_shape.link_violations_ > 0);
+    CHECK(tree_pair.first.shape().is_valid());
+}
+
+TEST_CASE("Test multi-point split and multi-way merge") {
+    std::vector<int> vals(500);
+    for (size_t i = 0; i < vals.size(); ++i) {
+        vals[i] = i;
+    }
+    std::shared_ptr<IBST<int>> tree = std::make_shared<VirtualBST<int>>(vals.begin(), vals.end());
+    for (auto it = tree->begin(); it != tree->end(); ++it) {
+        it.set_is_vertex(*it % 2 == 0);
+    }
+    std::vector<size_t> cuts = {0, 3, 3, 100, 101, 250, 499, 500};
+    std::vector<IBST<int>::iterator> points;
+    for (size_t cut : cuts) {
+        points.emplace_back(tree->kth(cut));
+    }
+    auto parts = tree->split_at(points);
+    REQUIRE(parts.size() == cuts.size() + 1);
+    size_t from = 0;
+    for (size_t i = 0; i < parts.size(); ++i) {
+        size_t to = i < cuts.size() ? cuts[i] : vals.size();
+        CheckTreeContent(parts[i], std::vector<int>(vals.begin() + from, vals.begin() + to));
+        CHECK(parts[i]->size() == (to + 1) / 2 - (from + 1) / 2);
+        from = to;
+    }
+    std::reverse(parts.begin(), parts.end());
+    auto first = parts.front();
+    first->merge_all(std::vector<std::shared_ptr<IBST<int>>>(parts.begin() + 1, parts.end()));
+    std::vector<int> expected;
+    for (int i = parts.size() - 1, to = vals.size(); i >= 0; --i) {
+        int begin = i > 0 ? cuts[i - 1] : 0;
+        expected.insert(expected.end(), vals.begin() + begin, vals.begin() + to);
+        to = begin;
+    }
+    CheckTreeContent(first, expected);
+    CHECK(first->size() == 250);
+    CHECK(first->index_of(first->end()) == 500);
+}
+
+TEST_CASE("Test one-pass split and merge keep treaps valid") {
+    typedef CartesianBST<int, 1, AffineAggregate> Tree;
+    Tree::Pool pool;
+    std::mt19937 gen(11);
+    std::vector<int> vals(2000);
+    for (size_t i = 0; i < vals.size(); ++i) {
+        vals[i] = i;
+    }
+    Tree tree(vals.begin(), vals.end(), pool);
+    std::vector<Tree::iterator> nodes;
+    for (auto it = tree.begin(); it != tree.end(); ++it) {
+        it.set_is_vertex(*it % 3 == 0);
+        it.set_has_level_edges(*it % 5 == 0);
+        it.set_payload({*it % 7 + 1, *it});
+        nodes.emplace_back(it);
+    }
+    auto aggregate_of = [](const std::vector<int>& values) {
+        auto aggregate = AffineAggregate::Identity();
+        for (int value : values) {
+            aggregate = AffineAggregate::Combine(aggregate, {value % 7 + 1, value});
+        }
+        return aggregate;
+    };
+    std::vector<Tree::iterator> points;
+    std::vector<Tree> parts;
+    for (size_t round = 0; round < 20; ++round) {
+        std::vector<size_t> cuts(gen() % 300 + 1);
+        for (size_t& cut : cuts) {
+            cut = gen() % (vals.size() + 1);
+        }
+        std::sort(cuts.begin(), cuts.end());
+        points.clear();
+        for (size_t cut : cuts) {
+            points.emplace_back(cut < vals.size() ? nodes[vals[cut]] : tree.end());
+        }
+        Tree::split_at(points, &parts);
+        size_t from = 0;
+        for (size_t i = 0; i < parts.size(); ++i) {
+            size_t to = i < cuts.size() ? cuts[i] : vals.size();
+            std::vector<int> part_vals(vals.begin() + from, vals.begin() + to);
+            CheckTreeContent(&parts[i], part_vals);
+            REQUIRE(parts[i].shape().is_valid());
+            if (!part_vals.empty()) {
+                CHECK(parts[i].begin().tree_aggregate() == aggregate_of(part_vals));
+            }
+            from = to;
+        }
+        std::shuffle(parts.begin(), parts.end(), gen);
+        tree = parts.front();
+        tree.merge_all(std::vector<Tree>(parts.begin() + 1, parts.end()));
+        REQUIRE(tree.shape().is_valid());
+        vals.clear();
+        for (auto it = tree.begin(); it != tree.end(); ++it) {
+            vals.emplace_back(*it);
+        }
+        REQUIRE(vals.size() == nodes.size());
+        CHECK(tree.begin().tree_aggregate() == aggregate_of(vals));
+        CHECK(tree.index_of(tree.end(), true) == (nodes.size() + 2) / 3);
+    }
+}
+
 TEST_CASE("Test iterators coherence") {
 }
\ No newline at end of file
@@ -0,0 +1,141 @@
+#define CATCH_CONFIG_MAIN
+
+#include <algorithm>
+#include <random>
+
+#include "../../src/bst/skip_list_bst.h"
+#include "../catch/catch.hpp"
+
+template <class T>
+SkipListBST<T> TreeOf(const typename SkipListBST<T>::iterator& it) {
+    return SkipListBST<T>(it.pool(), it.get_root().index());
+}
+
+TEST_CASE("Test skip list batch split and merge") {
+    SkipListBST<int>::Pool pool;
+    std::mt19937 gen(42);
+    const int n_values = 5000, part = 50;
+    std::vector<int> vals(n_values);
+    for (int i = 0; i < n_values; ++i) {
+        vals[i] = i;
+    }
+    SkipListBST<int> tree(vals.begin(), vals.end(), pool);
+    std::vector<SkipListBST<int>::iterator> nodes;
+    for (auto it = tree.begin(); it != tree.end(); ++it) {
+        nodes.emplace_back(it);
+    }
+    std::vector<SkipListBST<int>::iterator> cuts;
+    for (int i = part; i < n_values; i += part) {
+        cuts.emplace_back(nodes[i]);
+    }
+    std::shuffle(cuts.begin(), cuts.end(), gen);
+    SkipListBST<int>::split_batch(cuts);
+    for (int i = 0; i < n_values; i += part) {
+        auto piece = TreeOf<int>(nodes[i]);
+        REQUIRE(*piece.begin() == i);
+        REQUIRE(*--piece.end() == i + part - 1);
+    }
+    CHECK(pool.Used() == n_values + n_values / part);
+
+    // Glue the parts back in the reversed order
+    std::vector<std::pair<SkipListBST<int>::iterator, SkipListBST<int>::iterator>> links;
+    for (int i = part; i < n_values; i += part) {
+        links.emplace_back(nodes[i + part - 1], nodes[i - part]);
+    }
+    std::shuffle(links.begin(), links.end(), gen);
+    SkipListBST<int>::merge_batch(links);
+    std::vector<int> expected;
+    for (int i = n_values - part; i >= 0; i -= part) {
+        for (int j = 0; j < part; ++j) {
+            expected.emplace_back(i + j);
+        }
+    }
+    std::vector<int> result;
+    for (int value : TreeOf<int>(nodes[0])) {
+        result.emplace_back(value);
+    }
+    CHECK(result == expected);
+    CHECK(pool.Used() == n_values + 1);
+
+    links.emplace_back(nodes[part - 1], nodes[n_values - part]);
+    CHECK_THROWS_AS(SkipListBST<int>::merge_batch({links.back()}), std::logic_error);
+}
+
+TEST_CASE("Test skip list parallel batches agree with serial splits and merges") {
+    // Enough operations over enough sequences to go to the worker threads
+    WorkerThreads workers(4);
+    SkipListBST<int>::Pool parallel_pool(workers), serial_pool;
+    std::mt19937 gen(7);
+    const int n_trees = 64, length = 64, part = 2;
+    std::vector<int> vals(length);
+    std::vector<SkipListBST<int>::iterator> parallel_nodes, serial_nodes;
+    for (int tree = 0; tree < n_trees; ++tree) {
+        for (int i = 0; i < length; ++i) {
+            vals[i] = tree * length + i;
+        }
+        SkipListBST<int> parallel_tree(vals.begin(), vals.end(), parallel_pool);
+        SkipListBST<int> serial_tree(vals.begin(), vals.end(), serial_pool);
+        for (auto it = parallel_tree.begin(); it != parallel_tree.end(); ++it) {
+            parallel_nodes.emplace_back(it);
+        }
+        for (auto it = serial_tree.begin(); it != serial_tree.end(); ++it) {
+            serial_nodes.emplace_back(it);
+        }
+    }
+    auto check_same = [&](int first) {
+        std::vector<int> parallel_values, serial_values;
+        for (int value : TreeOf<int>(parallel_nodes[first])) {
+            parallel_values.emplace_back(value);
+        }
+        for (int value : TreeOf<int>(serial_nodes[first])) {
+            serial_values.emplace_back(value);
+        }
+        REQUIRE(parallel_values == serial_values);
+        return parallel_values;
+    };
+
+    std::vector<int> cut_indices;
+    for (int tree = 0; tree < n_trees; ++tree) {
+        for (int i = part; i < length; i += part) {
+            cut_indices.emplace_back(tree * length + i);
+        }
+    }
+    std::shuffle(cut_indices.begin(), cut_indices.end(), gen);
+    std::vector<SkipListBST<int>::iterator> cuts;
+    for (int index : cut_indices) {
+        cuts.emplace_back(parallel_nodes[index]);
+        serial_nodes[index].split();
+    }
+    REQUIRE(cuts.size() >= 1024);
+    SkipListBST<int>::split_batch(cuts);
+    for (int first = 0; first < n_trees * length; first += part) {
+        CHECK(check_same(first) == std::vector<int>({first, first + 1}));
+    }
+    CHECK(parallel_pool.Used() == serial_pool.Used());
+
+    // Glue the parts of every sequence back in the reversed order
+    std::vector<std::pair<int, int>> link_indices;
+    for (int tree = 0; tree < n_trees; ++tree) {
+        for (int i = part; i < length; i += part) {
+            link_indices.emplace_back(tree * length + i + part - 1, tree * length + i - part);
+        }
+    }
+    std::shuffle(link_indices.begin(), link_indices.end(), gen);
+    std::vector<std::pair<SkipListBST<int>::iterator, SkipListBST<int>::iterator>> links;
+    for (const auto& link : link_indices) {
+        links.emplace_back(parallel_nodes[link.first], parallel_nodes[link.second]);
+        auto lhs = TreeOf<int>(serial_nodes[link.first]);
+        lhs.merge(TreeOf<int>(serial_nodes[link.second]));
+    }
+    SkipListBST<int>::merge_batch(links);
+    for (int tree = 0; tree < n_trees; ++tree) {
+        std::vector<int> expected;
+        for (int i = length - part; i >= 0; i -= part) {
+            expected.emplace_back(tree * length + i);
+            expected.emplace_back(tree * length + i + 1);
+        }
+        CHECK(check_same(tree * length) == expected);
+    }
+    CHECK(parallel_pool.Used() == serial_pool.Used());
+    CHECK(parallel_pool.Used() == n_trees * (length + 1));
+}
@@ -0,0 +1,41 @@
+#define CATCH_CONFIG_MAIN
+
+#include <algorithm>
+
+#include "../../src/bst/splay_bst.h"
+#include "../catch/catch.hpp"
+
+TEST_CASE("Test splay collects flagged") {
+    SplayBST<int>::Pool pool;
+    std::vector<int> vals = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+    SplayBST<int> tree(vals.begin(), vals.end(), pool);
+    std::vector<int> flagged = {1, 2, 5, 10, 11};
+    for (auto it = tree.begin(); it != tree.end(); ++it) {
+        it.set_is_vertex(*it % 2 == 0);
+        if (std::find(flagged.begin(), flagged.end(), *it) != flagged.end()) {
+            it.set_has_level_edges(true);
+        }
+    }
+    std::vector<int> result;
+    tree.collect_flagged(0, &result);
+    CHECK(result == flagged);
+}
+
+TEST_CASE("Test splay order statistics") {
+    SplayBST<int>::Pool pool;
+    std::vector<int> vals = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9};
+    SplayBST<int> tree(vals.begin(), vals.end(), pool);
+    for (auto it = tree.begin(); it != tree.end(); ++it) {
+        it.set_is_vertex(*it % 2 == 1);
+    }
+    for (int i = 0; i < 10; ++i) {
+        auto it = tree.kth(i);
+        CHECK(*it == i);
+        CHECK(tree.index_of(it) == static_cast<size_t>(i));
+        CHECK(tree.index_of(it, true) == static_cast<size_t>(i / 2));
+    }
+    CHECK(*tree.kth(3, true) == 7);
+    CHECK(tree.kth(5, true) == tree.end());
+    CHECK(tree.index_of(tree.end()) == 10);
+    CHECK(tree.index_of(tree.end(), true) == 5);
+}
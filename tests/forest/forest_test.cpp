@@ -1,8 +1,36 @@
 #define CATCH_CONFIG_MAIN
 
+#include <algorithm>
+#include <map>
+#include <random>
+#include <thread>
+
 #include "../../src/forest/simple_forest.cpp"
 #include "../catch/catch.hpp"
 
+// Compares every connectivity query with the components of the edges
+template <class ForestType>
+void CheckComponents(ForestType& f, size_t n_vertices,
+                     const std::vector<std::pair<size_t, size_t>>& edges) {
+    std::vector<size_t> component(n_vertices);
+    for (size_t i = 0; i < n_vertices; ++i) {
+        component[i] = i;
+    }
+    for (size_t i = 0; i < n_vertices; ++i) {
+        for (const auto& edge : edges) {
+            size_t low = std::min(component[edge.first], component[edge.second]);
+            component[edge.first] = component[edge.second] = low;
+        }
+    }
+    for (size_t a = 0; a < n_vertices; ++a) {
+        for (size_t b = 0; b < n_vertices; ++b) {
+            if (a != b) {
+                REQUIRE(f.is_connected(a, b) == (component[a] == component[b]));
+            }
+        }
+    }
+}
+
 TEST_CASE("Test empty forest") {
     Forest f = Forest(0);
     SECTION("Edge cannot be added") {
@@ -180,4 +208,228 @@ TEST_CASE("Test three vertex forest") {
             CHECK_FALSE(f.is_connected(2, 1));
         }
     }
-}
\ No newline at end of file
+}
+
+TEMPLATE_TEST_CASE("Test random forest", "", Forest<CartesianBST<size_t>>,
+                   Forest<SplayBST<size_t>>, Forest<SkipListBST<size_t>>,
+                   Forest<BTreeBST<size_t>>) {
+    const size_t n_vertices = 12;
+    std::mt19937 gen(42);
+    for (size_t run = 0; run < 20; ++run) {
+        TestType f(n_vertices);
+        std::vector<std::pair<size_t, size_t>> edges;
+        for (size_t step = 0; step < 200; ++step) {
+            size_t u = gen() % n_vertices, v = gen() % n_vertices;
+            if (u != v && gen() % 2 && !f.is_connected(u, v)) {
+                f.add_new_edge(u, v);
+                edges.emplace_back(u, v);
+            } else if (!edges.empty()) {
+                size_t idx = gen() % edges.size();
+                f.erase_existing_edge(edges[idx].second, edges[idx].first);
+                edges.erase(edges.begin() + idx);
+            }
+            CheckComponents(f, n_vertices, edges);
+        }
+    }
+}
+
+TEMPLATE_TEST_CASE("Test building forests", "", Forest<CartesianBST<size_t>>,
+                   Forest<SplayBST<size_t>>, Forest<SkipListBST<size_t>>,
+                   Forest<BTreeBST<size_t>>) {
+    const size_t n_vertices = 40;
+    std::mt19937 gen(17);
+    for (size_t run = 0; run < 10; ++run) {
+        std::vector<std::pair<size_t, size_t>> edges;
+        for (size_t v = 1; v < n_vertices; ++v) {
+            if (gen() % 4) {
+                size_t parent = gen() % v;
+                edges.push_back(gen() % 2 ? std::make_pair(parent, v) : std::make_pair(v, parent));
+            }
+        }
+        std::shuffle(edges.begin(), edges.end(), gen);
+        TestType f(n_vertices, edges);
+        // Cutting every edge checks the traversals recorded for it
+        while (true) {
+            CheckComponents(f, n_vertices, edges);
+            if (edges.empty()) {
+                break;
+            }
+            size_t idx = gen() % edges.size();
+            f.erase_existing_edge(edges[idx].second, edges[idx].first);
+            edges.erase(edges.begin() + idx);
+        }
+    }
+    CHECK_THROWS_AS(TestType(3, {{0, 1}, {1, 2}, {2, 0}}), std::runtime_error);
+    CHECK_THROWS_AS(TestType(3, {{0, 1}, {1, 0}}), std::runtime_error);
+    CHECK_THROWS_AS(TestType(3, {{1, 1}}), std::runtime_error);
+    CHECK_THROWS_AS(TestType(3, {{1, 3}}), std::runtime_error);
+}
+
+TEST_CASE("Test component aggregates") {
+    Forest<CartesianBST<size_t, 1, SumAggregate<int>>> f(5);
+    for (size_t i = 0; i < 5; ++i) {
+        f.set_payload(i, static_cast<int>(i + 1));
+    }
+    f.add_new_edge(0, 1);
+    f.add_new_edge(1, 2);
+    f.add_new_edge(3, 4);
+    CHECK(f.component_aggregate(0) == 6);
+    CHECK(f.component_aggregate(4) == 9);
+    f.set_payload(2, 10);
+    CHECK(f.component_aggregate(1) == 13);
+    f.erase_existing_edge(0, 1);
+    CHECK(f.component_aggregate(0) == 1);
+    CHECK(f.component_aggregate(2) == 12);
+    CHECK_THROWS_AS(f.component_aggregate(5), std::runtime_error);
+}
+
+TEST_CASE("Test forest snapshots") {
+    const size_t n_vertices = 5000;
+    Forest f = Forest(n_vertices);
+    for (size_t i = 1; i < n_vertices; ++i) {
+        f.add_new_edge(i - 1, i);
+    }
+    auto whole = f.snapshot();
+    for (size_t i = 100; i < n_vertices; i += 100) {
+        f.erase_existing_edge(i - 1, i);
+    }
+    auto pieces = f.snapshot();
+    CHECK_THROWS_AS(whole.is_connected(0, 0), std::runtime_error);
+    CHECK_THROWS_AS(whole.is_connected(0, n_vertices), std::runtime_error);
+
+    // The writer keeps relinking while another thread reads both snapshots
+    bool reads_match = true;
+    std::thread reader([&]() {
+        for (size_t i = 1; i < n_vertices; ++i) {
+            reads_match &= whole.is_connected(0, i);
+            reads_match &= pieces.is_connected(i - 1, i) == (i % 100 != 0);
+        }
+    });
+    for (size_t i = 100; i < n_vertices; i += 100) {
+        f.add_new_edge(i, i - 1);
+    }
+    reader.join();
+    CHECK(reads_match);
+    CHECK(f.is_connected(0, n_vertices - 1));
+    CHECK(!pieces.is_connected(0, n_vertices - 1));
+}
+
+TEST_CASE("Test reroot") {
+    Forest f = Forest(6);
+    f.add_new_edge(0, 1);
+    f.add_new_edge(1, 2);
+    f.add_new_edge(3, 1);
+    f.add_new_edge(4, 5);
+    // Rerooting moves the roots that queries have cached
+    for (size_t v = 0; v < 6; ++v) {
+        CHECK(f.is_connected(0, 3));
+        CHECK(!f.is_connected(2, 4));
+        f.reroot(v);
+        CHECK(f.shape().is_valid());
+        CHECK(f.is_connected(0, 3));
+        CHECK(!f.is_connected(2, 4));
+    }
+    f.erase_existing_edge(1, 0);
+    CHECK(!f.is_connected(0, 3));
+    CHECK(f.is_connected(2, 3));
+    CHECK_THROWS_AS(f.reroot(6), std::runtime_error);
+}
+
+TEST_CASE("Test a link walks once per tour and once to splice") {
+    typedef CartesianBST<size_t, 1, NoAggregate, true> Tree;
+    Forest<Tree> f(4);
+    // Isolated vertices: the pieces are single nodes, so the splice zips no spines
+    uint64_t walks = Tree::root_walks();
+    f.add_new_edge(0, 1);
+    CHECK(Tree::root_walks() - walks == 3);
+    f.add_new_edge(2, 3);
+    walks = Tree::root_walks();
+    f.add_new_edge(1, 2);
+    CHECK(Tree::root_walks() - walks <= 7);
+    CHECK(f.shape().is_valid());
+    CHECK(f.is_connected(0, 3));
+}
+
+TEST_CASE("Test edge table") {
+    // Erasing from a small table shifts back long runs of entries
+    EdgeTable<size_t> table;
+    std::map<uint64_t, size_t> expected;
+    std::mt19937 gen(7);
+    for (size_t step = 0; step < 20000; ++step) {
+        size_t u = gen() % 60, v = gen() % 60;
+        if (u == v) {
+            continue;
+        }
+        uint64_t key = EdgeTable<size_t>::Key(u, v);
+        REQUIRE(key == EdgeTable<size_t>::Key(v, u));
+        size_t slot = table.Find(key);
+        REQUIRE((slot != EdgeTable<size_t>::kNotFound) == expected.count(key));
+        if (slot != EdgeTable<size_t>::kNotFound) {
+            REQUIRE(table.At(slot) == expected[key]);
+            if (gen() % 2) {
+                table.EraseAt(slot);
+                expected.erase(key);
+                continue;
+            }
+        }
+        table.Insert(key, step);
+        expected[key] = step;
+        REQUIRE(table.size() == expected.size());
+    }
+    for (const auto& [key, value] : expected) {
+        REQUIRE(table.At(table.Find(key)) == value);
+    }
+}
+
+TEST_CASE("Test forest shape") {
+    const size_t n_vertices = 300;
+    Forest f = Forest(n_vertices);
+    for (size_t i = 1; i < n_vertices; ++i) {
+        if (i % 100) {
+            f.add_new_edge(i / 2, i);
+        }
+    }
+    auto shape = f.shape();
+    CHECK(shape.is_valid());
+    // Every tour holds its vertices and two nodes per edge
+    CHECK(shape.n_nodes_ == n_vertices + 2 * (n_vertices - 3));
+    CHECK(shape.tree_sizes_.size() == 3);
+    CHECK(f.sample_depth(30) < shape.height());
+}
+
+TEST_CASE("Test concurrent readers") {
+    const size_t n_vertices = 2000, path = n_vertices / 2 - 1, leaf = path;
+    Forest f = Forest(n_vertices);
+    for (size_t i = 1; i < path; ++i) {
+        f.add_new_edge(i - 1, i);
+    }
+    for (size_t i = n_vertices / 2 + 1; i < n_vertices; ++i) {
+        f.add_new_edge(i - 1, i);
+    }
+    f.add_new_edge(0, leaf);
+    // Moving the leaf reroots and splits the tour of the path, which readers must never see
+    std::atomic<bool> done(false);
+    std::vector<char> reads_match(3, true);
+    std::vector<std::thread> readers;
+    for (size_t r = 0; r < reads_match.size(); ++r) {
+        readers.emplace_back([&, r]() {
+            for (size_t i = 0; !done; i = (i + 97) % (path - 1)) {
+                reads_match[r] &= f.concurrent_is_connected(i, i + 1);
+                reads_match[r] &= !f.concurrent_is_connected(i, n_vertices / 2 + i);
+            }
+        });
+    }
+    for (size_t step = 0, attached = 0; step < 3000; ++step) {
+        f.erase_existing_edge(attached, leaf);
+        attached = step * 31 % path;
+        f.add_new_edge(attached, leaf);
+    }
+    done = true;
+    for (auto& reader : readers) {
+        reader.join();
+    }
+    for (char match : reads_match) {
+        CHECK(match);
+    }
+    CHECK(f.concurrent_is_connected(0, leaf));
+}
@@ -1,5 +1,7 @@
 #define CATCH_CONFIG_MAIN
 
+#include <random>
+
 #include "../../src/graph/dynamic_graph.cpp"
 #include "../catch/catch.hpp"
 
@@ -181,3 +183,107 @@ TEST_CASE("Test three vertex graph") {
         }
     }
 }
+
+TEST_CASE("Test cycle keeps connected") {
+    DynamicGraph g = DynamicGraph(4);
+    g.insert(0, 1);
+    g.insert(1, 2);
+    g.insert(2, 3);
+    g.insert(3, 0);
+    SECTION("Tree edge is replaced") {
+        CHECK_NOTHROW(g.erase(1, 2));
+        CHECK(g.is_connected(1, 2));
+        CHECK(g.is_connected(0, 3));
+    }
+    SECTION("Non-tree edge is removed") {
+        CHECK_NOTHROW(g.erase(3, 0));
+        CHECK(g.is_connected(0, 3));
+        CHECK_THROWS_AS(g.erase(0, 3), std::runtime_error);
+        CHECK_NOTHROW(g.erase(2, 3));
+        CHECK_FALSE(g.is_connected(0, 3));
+    }
+}
+
+TEST_CASE("Test tree edges below the top level") {
+    // Path 0-1-2-3-4 closed by 0-4. Erasing 1-2 cuts off {0, 1}, which pushes 0-1 one level
+    // down, and 0-4 replaces 1-2 at the top level
+    DynamicGraph g = DynamicGraph(5);
+    g.insert(0, 1);
+    g.insert(1, 2);
+    g.insert(2, 3);
+    g.insert(3, 4);
+    g.insert(0, 4);
+    CHECK_NOTHROW(g.erase(1, 2));
+    CHECK(g.is_connected(1, 2));
+    SECTION("Replacement only on a level above") {
+        // The new edge stays at the top level, so no replacement is found at the level of 0-1
+        g.insert(1, 4);
+        CHECK_NOTHROW(g.erase(0, 1));
+        CHECK(g.is_connected(0, 1));
+        CHECK(g.is_connected(1, 3));
+        CHECK_NOTHROW(g.erase(1, 4));
+        CHECK_FALSE(g.is_connected(0, 1));
+    }
+    SECTION("No replacement") {
+        CHECK_NOTHROW(g.erase(0, 1));
+        CHECK_FALSE(g.is_connected(0, 1));
+        CHECK_FALSE(g.is_connected(1, 4));
+        CHECK(g.is_connected(0, 2));
+        CHECK_THROWS_AS(g.erase(0, 1), std::runtime_error);
+        CHECK_NOTHROW(g.insert(1, 0));
+        CHECK(g.is_connected(1, 3));
+    }
+}
+
+TEMPLATE_TEST_CASE("Test random updates agree with a search", "",
+                   (DynamicGraph<CartesianBST<uint32_t, 2>>), (DynamicGraph<SplayBST<uint32_t, 2>>),
+                   (DynamicGraph<SkipListBST<uint32_t, 2>>),
+                   (DynamicGraph<BTreeBST<uint32_t, 2>>)) {
+    const size_t n_vertices = 8;
+    std::mt19937 gen(7);
+    TestType g(n_vertices);
+    std::vector<std::vector<bool>> edges(n_vertices, std::vector<bool>(n_vertices));
+    for (size_t step = 0; step < 400; ++step) {
+        size_t u = gen() % n_vertices, v = gen() % n_vertices;
+        if (u == v) {
+            continue;
+        }
+        if (edges[u][v]) {
+            REQUIRE_NOTHROW(g.erase(u, v));
+        } else {
+            REQUIRE_NOTHROW(g.insert(u, v));
+        }
+        edges[u][v] = edges[v][u] = !edges[u][v];
+        for (size_t from = 0; from < n_vertices; ++from) {
+            std::vector<bool> seen(n_vertices);
+            std::vector<size_t> stack = {from};
+            seen[from] = true;
+            while (!stack.empty()) {
+                size_t cur = stack.back();
+                stack.pop_back();
+                for (size_t to = 0; to < n_vertices; ++to) {
+                    if (edges[cur][to] && !seen[to]) {
+                        seen[to] = true;
+                        stack.emplace_back(to);
+                    }
+                }
+            }
+            for (size_t to = from + 1; to < n_vertices; ++to) {
+                REQUIRE(g.is_connected(from, to) == seen[to]);
+            }
+        }
+    }
+}
+
+TEST_CASE("Test graph snapshots") {
+    DynamicGraph g = DynamicGraph(4);
+    g.insert(0, 1);
+    g.insert(2, 3);
+    auto before = g.snapshot();
+    g.insert(1, 2);
+    auto after = g.snapshot();
+    CHECK(!before.is_connected(0, 3));
+    CHECK(before.is_connected(2, 3));
+    CHECK(after.is_connected(0, 3));
+    CHECK(g.is_connected(0, 3));
+}